@@ -53,20 +53,26 @@
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
  *        ranges - these will never be matched.
+ *
+ *   tlb_setentryhi: load ENTRYHI into the coprocessor without touching
+ *        the TLB. Only the PID field matters: it is the address space
+ *        ID that translations are matched against. Note that the other
+ *        functions above all leave ENTRYHI as whatever they were passed.
  */
 
 void tlb_random(uint32_t entryhi, uint32_t entrylo);
 void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
+void tlb_setentryhi(uint32_t entryhi);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * The MIPS has support for a 6-bit address space ID (TLBHI_PID). An
+ * entry only matches if its PID equals the one currently in ENTRYHI,
+ * or if it has TLBLO_GLOBAL set; we never set TLBLO_GLOBAL. Bits that
+ * aren't assigned a meaning can be left zero.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,14 +84,18 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
 #define TLBLO_NOCACHE 0x00000800
 #define TLBLO_DIRTY   0x00000400
 #define TLBLO_VALID   0x00000200
-/*      TLBLO_GLOBAL  0x00000100 */
+#define TLBLO_GLOBAL  0x00000100
+
+/* Place address space ID ASID in the PID field, and the number of them. */
+#define TLBHI_ASID(asid) (((uint32_t)(asid) << 6) & TLBHI_PID)
+#define NUM_ASID      64
 
 /*
  * Values for completely invalid TLB entries. The TLB entry index should
@@ -128,14 +128,30 @@ paddr_t ram_getfirstfree(void);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct semaphore;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;		/* page to invalidate */
+	unsigned ts_asid;		/* address space it belongs to */
+	struct semaphore *ts_done;	/* V'd once the entry is gone */
 };
 
 #define TLBSHOOTDOWN_MAX 16
 
+/*
+ * What each cpu has loaded into its TLB, for the software replacement
+ * policies (options tlbrr, tlbnru): the EntryHi of each slot, which
+ * slots hold a valid entry, which have been loaded since the hand
+ * last went past, and the hand itself.
+ */
+#define TLBSHADOW_SIZE 64	/* NUM_TLB */
+
+struct tlbshadow {
+	uint32_t ts_entryhi[TLBSHADOW_SIZE];
+	uint64_t ts_valid;
+	uint64_t ts_used;
+	unsigned ts_hand;
+};
+
 
 #endif /* _MIPS_VM_H_ */
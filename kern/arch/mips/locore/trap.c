@@ -125,6 +125,21 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	thread_exit();
 }
 
+/*
+ * Exit if the out-of-memory killer has picked this process. Only
+ * called on traps from user mode, when we hold nothing.
+ */
+static
+void
+check_oom_killed(void)
+{
+	if (vm_oom_killed()) {
+		kprintf("Process %d killed: out of memory\n",
+			curproc->p_pid);
+		proc_exit(_MKWAIT_SIG(SIGKILL));
+	}
+}
+
 /*
  * General trap (exception) handling function for mips.
  * This is called by the assembly-language exception handler once
@@ -230,9 +245,14 @@ mips_trap(struct trapframe *tf)
 		      tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
 
 		syscall(tf);
+		check_oom_killed();
 		goto done;
 	}
 
+	if (!iskern) {
+		check_oom_killed();
+	}
+
 	/*
 	 * Ok, it wasn't any of the really easy cases.
 	 * Call vm_fault on the TLB exceptions.
@@ -278,8 +298,10 @@ mips_trap(struct trapframe *tf)
 	if (!iskern) {
 		/*
 		 * Fatal fault in user mode.
-		 * Kill the current user process.
+		 * Kill the current user process. If the fault failed
+		 * because the OOM killer picked us, say so instead.
 		 */
+		check_oom_killed();
 		kill_curthread(tf->tf_epc, code, tf->tf_vaddr);
 		goto done;
 	}
@@ -37,6 +37,7 @@
 #include <current.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include "opt-dumbvm.h"
 
 
 /*
@@ -113,6 +114,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 
 	    /* process calls */
 
@@ -142,6 +148,102 @@ syscall(struct trapframe *tf)
 		err = sys_getpid(&retval);
 		break;
 
+	    case SYS_getrusage:
+		err = sys_getrusage(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_getrlimit:
+		err = sys_getrlimit(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_setrlimit:
+		err = sys_setrlimit(tf->tf_a0, (const_userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_getpriority:
+		err = sys_getpriority(tf->tf_a0, tf->tf_a1, &retval);
+		break;
+
+	    case SYS_setpriority:
+		err = sys_setpriority(tf->tf_a0, tf->tf_a1, tf->tf_a2);
+		break;
+
+	    case SYS_sched_setaffinity:
+		err = sys_sched_setaffinity(tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_sched_getaffinity:
+		err = sys_sched_getaffinity(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+
+	    /* memory calls */
+
+#if !OPT_DUMBVM
+	    case SYS_sbrk:
+		{
+			vaddr_t oldbreak;
+
+			err = sys_sbrk((intptr_t)tf->tf_a0, &oldbreak);
+			retval = (int32_t)oldbreak;
+		}
+		break;
+
+	    case SYS_mmap:
+		{
+			/*
+			 * The offset is 64 bits wide and aligned, so it
+			 * skips a3 and is found on the stack.
+			 */
+			off_t offset;
+			vaddr_t addr;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &offset, sizeof(off_t));
+			if (err) {
+				break;
+			}
+
+			err = sys_mmap(tf->tf_a0, tf->tf_a1, tf->tf_a2,
+				       offset, &addr);
+			retval = (int32_t)addr;
+		}
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap(tf->tf_a0);
+		break;
+
+	    case SYS_mprotect:
+		err = sys_mprotect(tf->tf_a0, tf->tf_a1, tf->tf_a2);
+		break;
+
+	    case SYS_madvise:
+		err = sys_madvise(tf->tf_a0, tf->tf_a1, tf->tf_a2);
+		break;
+
+	    case SYS_shmget:
+		err = sys_shmget(tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
+		break;
+
+	    case SYS_shmat:
+		{
+			vaddr_t addr;
+
+			err = sys_shmat(tf->tf_a0, tf->tf_a1, &addr);
+			retval = (int32_t)addr;
+		}
+		break;
+
+	    case SYS_shmdt:
+		err = sys_shmdt(tf->tf_a0);
+		break;
+
+	    case SYS_shmctl:
+		err = sys_shmctl(tf->tf_a0, tf->tf_a1);
+		break;
+#endif
+
 
 	    /* file calls */
 
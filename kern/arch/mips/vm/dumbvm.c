@@ -156,6 +156,18 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+bool
+vm_idle(void)
+{
+	return false;
+}
+
+bool
+vm_oom_killed(void)
+{
+	return false;
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -32,6 +32,13 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <spinlock.h>
+#include <membar.h>
+#include <current.h>
+#include <cpu.h>
+#include <thread.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <swap.h>
 
 vaddr_t firstfree;   /* first free virtual address; set by start.S */
 
@@ -40,15 +47,47 @@ static paddr_t lastpaddr;   /* one past end of last free physical page */
 
 
 
+/*
+ * The frame table doubles as the coremap: for frames holding user
+ * pages it records which address space maps the frame and where, so
+ * the replacement policy can go from a frame back to its page table
+ * entry without walking any page tables.
+ */
 typedef struct ft_entry {
         unsigned allocated:1; /* the corresponding frame is allocated */
         unsigned not_last:1; /* the frame is part of a multiframe allocation */
+        unsigned busy:1;     /* being paged out; don't pick it again */
+        unsigned pinned:1;   /* kernel needs it resident (e.g. mid-I/O) */
+        unsigned refcount:16; /* page table entries sharing the frame (COW) */
+        unsigned free_head:1; /* first frame of a free buddy block */
+        unsigned order:5;    /* ... of 2^order frames */
+        bool referenced;     /* software reference bit for the clock; a
+                                byte of its own so it can be set unlocked */
+        struct addrspace *owner; /* user page mapped by this address space */
+        vaddr_t vaddr;           /* ... at this virtual address */
+        uint32_t next_free;  /* free list links between block heads */
+        uint32_t prev_free;
 } ft_entry_t;
 
 
 static ft_entry_t * frame_table = NULL; /* base of frame table */
 static uint32_t first_frame;
 static uint32_t last_frame;
+static uint32_t clock_hand; /* next frame considered for eviction */
+
+/*
+ * Buddy allocator free lists, one per block size: free_list[k] heads
+ * a doubly linked list (through next_free/prev_free) of free blocks of
+ * 2^k frames, each aligned to its size. Frame 0 always belongs to the
+ * kernel, so 0 ends a list. 2^17 frames covers the 512M we can map.
+ */
+#define BUDDY_ORDERS 18
+#define NO_FRAME 0
+static uint32_t free_list[BUDDY_ORDERS];
+static uint32_t free_frames_count; /* frames on all the lists */
+
+static void buddy_free_range(uint32_t i, uint32_t npages);
+static uint32_t buddy_alloc(unsigned int npages);
 
 #define PAGE_BITS 12
 #define TRUE 1
@@ -56,11 +95,25 @@ static uint32_t last_frame;
 
 
 /* frame_table protected by spinlock (interrupt disabling on
- * uniprocessor) as this implementation does not block.
+ * uniprocessor) as this implementation does not block. The exceptions
+ * are frames only one party can be touching: see frame_cache_get(),
+ * frame_set_owner() and the fast path in free_frames().
  */ 
 
 static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * Frames kept back for the kernel. alloc_kpages() falls back on these
+ * when nothing else is left, but user pages (alloc_upage) never get
+ * them, so kmalloc keeps working while the OOM killer makes room. The
+ * pool is filled at boot and topped up by frames as they are freed.
+ * Like cached frames they stay allocated with a refcount of 0.
+ * Protected by frame_table_spinlock.
+ */
+#define FRAME_RESERVE 16
+static paddr_t frame_reserve[FRAME_RESERVE];
+static unsigned frame_nreserve;
+
 /*
  * Called very early in system boot to figure out how much physical
  * RAM is available.
@@ -130,6 +183,9 @@ ram_bootstrap(void)
                 /* Mark as allocated as individual pages */
                 frame_table[i].allocated = TRUE;
                 frame_table[i].not_last = FALSE;
+                frame_table[i].refcount = 1;
+                frame_table[i].referenced = FALSE;
+                frame_table[i].owner = NULL;
         }                                            
         
         /* 
@@ -140,9 +196,28 @@ ram_bootstrap(void)
         
         for (i = first_frame; i < (lastpaddr >> PAGE_BITS); i++) {
                 frame_table[i].allocated = FALSE;
+                frame_table[i].refcount = 0;
+                frame_table[i].busy = FALSE;
+                frame_table[i].pinned = FALSE;
+                frame_table[i].referenced = FALSE;
+                frame_table[i].owner = NULL;
+                frame_table[i].free_head = FALSE;
         }
+        clock_hand = first_frame;
 
-        
+        for (i = 0; i < BUDDY_ORDERS; i++) {
+                free_list[i] = NO_FRAME;
+        }
+        buddy_free_range(first_frame, last_frame - first_frame);
+
+        while (frame_nreserve < FRAME_RESERVE) {
+                i = buddy_alloc(1);
+                if (i == NO_FRAME) {
+                        break;
+                }
+                frame_table[i].refcount = 0;
+                frame_reserve[frame_nreserve++] = i << PAGE_BITS;
+        }
 }
 
 /*
@@ -189,90 +264,428 @@ ram_getfirstfree(void)
 }
 
 /*
- * This is a relatively inefficient first-fit allocator. Single pages
- * always fit. Multiframe allocations can suffer from external
- * fragmentation. It is intended to be easy to understand and robust,
- * not efficient.
+ * Binary buddy allocator. Free memory is kept as blocks of 2^k frames
+ * aligned to their size; a block's buddy is the other half of the
+ * block twice the size, found by flipping bit k of its frame number.
+ * Allocation takes the smallest block that fits, splitting larger
+ * ones as needed, and freeing merges a block with its buddy for as
+ * long as the buddy is free too. A single frame is O(1) unless a
+ * block has to be split, and anything else O(log n).
+ *
+ * Allocated runs are still marked frame by frame with allocated and
+ * not_last, as the rest of the frame table expects.
  */
 
+static void buddy_push(uint32_t i, unsigned order)
+{
+        frame_table[i].free_head = TRUE;
+        frame_table[i].order = order;
+        frame_table[i].prev_free = NO_FRAME;
+        frame_table[i].next_free = free_list[order];
+        if (free_list[order] != NO_FRAME) {
+                frame_table[free_list[order]].prev_free = i;
+        }
+        free_list[order] = i;
+        free_frames_count += 1 << order;
+}
+
+static void buddy_remove(uint32_t i)
+{
+        unsigned order = frame_table[i].order;
 
-static paddr_t alloc_one_frame(unsigned int npages)
+        KASSERT(frame_table[i].free_head == TRUE);
+        if (frame_table[i].prev_free != NO_FRAME) {
+                frame_table[frame_table[i].prev_free].next_free =
+                        frame_table[i].next_free;
+        }
+        else {
+                free_list[order] = frame_table[i].next_free;
+        }
+        if (frame_table[i].next_free != NO_FRAME) {
+                frame_table[frame_table[i].next_free].prev_free =
+                        frame_table[i].prev_free;
+        }
+        frame_table[i].free_head = FALSE;
+        free_frames_count -= 1 << order;
+}
+
+/* give back the block of 2^order frames at i, merging with its buddies */
+static void buddy_free_block(uint32_t i, unsigned order)
 {
-        unsigned int i;
+        uint32_t buddy;
 
-        /* 
-         * Just scan from the start of the frame_table array for an
-         * unallocated block
-         */
-        
-        KASSERT(npages == 1);
+        while (order < BUDDY_ORDERS - 1) {
+                buddy = i ^ ((uint32_t)1 << order);
+                if (buddy < first_frame ||
+                    buddy + ((uint32_t)1 << order) > last_frame ||
+                    frame_table[buddy].free_head == FALSE ||
+                    frame_table[buddy].order != order) {
+                        break;
+                }
+                buddy_remove(buddy);
+                if (buddy < i) {
+                        i = buddy;
+                }
+                order++;
+        }
+        buddy_push(i, order);
+}
+
+/* give back npages frames starting at i, as the largest aligned blocks */
+static void buddy_free_range(uint32_t i, uint32_t npages)
+{
+        unsigned order;
+
+        while (npages > 0) {
+                order = 0;
+                while (order < BUDDY_ORDERS - 1 &&
+                       (i & ((uint32_t)1 << order)) == 0 &&
+                       ((uint32_t)2 << order) <= npages) {
+                        order++;
+                }
+                buddy_free_block(i, order);
+                i += (uint32_t)1 << order;
+                npages -= (uint32_t)1 << order;
+        }
+}
+
+/* take a run of npages frames off the free lists; frame table locked */
+static uint32_t buddy_alloc(unsigned int npages)
+{
+        unsigned int order, k;
+        uint32_t i, j;
+
+        KASSERT(npages > 0);
+        KASSERT(spinlock_do_i_hold(&frame_table_spinlock));
+
+        order = 0;
+        while (((uint32_t)1 << order) < npages) {
+                order++;
+                if (order == BUDDY_ORDERS) {
+                        return NO_FRAME;
+                }
+        }
+
+        for (k = order; k < BUDDY_ORDERS; k++) {
+                if (free_list[k] != NO_FRAME) {
+                        break;
+                }
+        }
+        if (k == BUDDY_ORDERS) {
+                /* no block big enough :-( */
+                return NO_FRAME;
+        }
+
+        i = free_list[k];
+        buddy_remove(i);
+
+        /* split off upper halves until the block is the right size */
+        while (k > order) {
+                k--;
+                buddy_push(i + ((uint32_t)1 << k), k);
+        }
+
+        /* and hand back the tail we don't need */
+        buddy_free_range(i + npages, ((uint32_t)1 << order) - npages);
+
+        for (j = i; j < i + npages; j++) {
+                frame_table[j].allocated = TRUE;
+                frame_table[j].not_last = TRUE;
+        }
+        frame_table[i + npages - 1].not_last = FALSE;
+
+        return i;
+}
+
+/* reset the bookkeeping of a frame that has just been handed out */
+static void frame_init(uint32_t i)
+{
+        frame_table[i].refcount = 1;
+        frame_table[i].owner = NULL;
+        frame_table[i].referenced = FALSE;
+        frame_table[i].busy = FALSE;
+        frame_table[i].pinned = FALSE;
+}
+
+static paddr_t alloc_frames(unsigned int npages)
+{
+        uint32_t i;
 
         spinlock_acquire(&frame_table_spinlock);
-        for (i =  first_frame; i < last_frame; i++) {
-                if (frame_table[i].allocated == FALSE) {
-                        frame_table[i].allocated = TRUE;
-                        frame_table[i].not_last = FALSE;
+        i = buddy_alloc(npages);
+        if (i != NO_FRAME) {
+                frame_init(i);
+        }
+        spinlock_release(&frame_table_spinlock);
 
-                        spinlock_release(&frame_table_spinlock);
+        return (paddr_t) (i << PAGE_BITS);
+}
 
-                        return (paddr_t) (i << PAGE_BITS);
+/*
+ * Per-cpu frame caches. Each cpu keeps up to CPU_FRAME_CACHE free
+ * single frames in curcpu->c_frames, so allocating or freeing one page
+ * normally takes no shared lock at all, only the cpu's own
+ * c_frames_lock, which nobody else takes unless memory is short. The
+ * cache is refilled from and drained to the buddy allocator
+ * CPU_FRAME_BATCH frames at a time. Cached frames stay marked
+ * allocated, with a refcount of 0 and no owner, so nothing else will
+ * look at them.
+ *
+ * Lock order: c_frames_lock, then frame_table_spinlock.
+ */
+static paddr_t frame_cache_get(void)
+{
+        struct cpu *c;
+        uint32_t i;
+
+        if (!CURCPU_EXISTS()) {
+                /* early in boot */
+                return alloc_frames(1);
+        }
+
+        c = curcpu->c_self;
+        spinlock_acquire(&c->c_frames_lock);
+        if (c->c_nframes == 0) {
+                spinlock_acquire(&frame_table_spinlock);
+                while (c->c_nframes < CPU_FRAME_BATCH) {
+                        i = buddy_alloc(1);
+                        if (i == NO_FRAME) {
+                                break;
+                        }
+                        frame_table[i].refcount = 0;
+                        c->c_frames[c->c_nframes++] = i << PAGE_BITS;
+                }
+                spinlock_release(&frame_table_spinlock);
+                if (c->c_nframes == 0 && c->c_nzeroed > 0) {
+                        /* short of memory: use a frame we zeroed */
+                        c->c_frames[c->c_nframes++] =
+                                c->c_zeroed[--c->c_nzeroed];
+                }
+                if (c->c_nframes == 0) {
+                        spinlock_release(&c->c_frames_lock);
+                        return (paddr_t) 0;
                 }
         }
-        
-        /* Did not find an unallocated frame :-( */
+        i = c->c_frames[--c->c_nframes] >> PAGE_BITS;
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].refcount == 0);
+        frame_init(i);
+        spinlock_release(&c->c_frames_lock);
 
+        return (paddr_t) (i << PAGE_BITS);
+}
+
+/* take a frame from the kernel's reserve, if there is one left */
+static paddr_t frame_reserve_get(void)
+{
+        uint32_t i;
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (frame_nreserve == 0) {
+                spinlock_release(&frame_table_spinlock);
+                return (paddr_t) 0;
+        }
+        i = frame_reserve[--frame_nreserve] >> PAGE_BITS;
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].refcount == 0);
+        frame_init(i);
         spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+
+        return (paddr_t) (i << PAGE_BITS);
 }
 
-static paddr_t alloc_multiple_frames(unsigned int npages)
+/* the frame at i has no references left and no owner */
+static void frame_cache_put(uint32_t i)
 {
-        unsigned int i,j;
+        struct cpu *c;
+        uint32_t j;
+        unsigned n;
 
+        frame_table[i].refcount = 0;
 
-        /* scan from 'i' for the number of needed free frames. If an
-         * allocated frame is encountered, restart the scan from after
-         * that point.
-         */
-        
+        /* the reserve comes first; checked unlocked, so only a hint */
+        if (frame_nreserve < FRAME_RESERVE) {
+                spinlock_acquire(&frame_table_spinlock);
+                if (frame_nreserve < FRAME_RESERVE) {
+                        frame_reserve[frame_nreserve++] = i << PAGE_BITS;
+                        spinlock_release(&frame_table_spinlock);
+                        return;
+                }
+                spinlock_release(&frame_table_spinlock);
+        }
+
+        if (!CURCPU_EXISTS()) {
+                spinlock_acquire(&frame_table_spinlock);
+                frame_table[i].allocated = FALSE;
+                buddy_free_block(i, 0);
+                spinlock_release(&frame_table_spinlock);
+                return;
+        }
+
+        c = curcpu->c_self;
+        spinlock_acquire(&c->c_frames_lock);
+        if (c->c_nframes == CPU_FRAME_CACHE) {
+                spinlock_acquire(&frame_table_spinlock);
+                for (n = 0; n < CPU_FRAME_BATCH; n++) {
+                        j = c->c_frames[--c->c_nframes] >> PAGE_BITS;
+                        frame_table[j].allocated = FALSE;
+                        buddy_free_block(j, 0);
+                }
+                spinlock_release(&frame_table_spinlock);
+        }
+        c->c_frames[c->c_nframes++] = i << PAGE_BITS;
+        spinlock_release(&c->c_frames_lock);
+}
+
+/* give all of one cpu's cached and zeroed frames back */
+static void frame_cache_drain_cpu(struct cpu *c)
+{
+        uint32_t i;
 
+        spinlock_acquire(&c->c_frames_lock);
         spinlock_acquire(&frame_table_spinlock);
+        while (c->c_nframes > 0) {
+                i = c->c_frames[--c->c_nframes] >> PAGE_BITS;
+                frame_table[i].allocated = FALSE;
+                buddy_free_block(i, 0);
+        }
+        while (c->c_nzeroed > 0) {
+                i = c->c_zeroed[--c->c_nzeroed] >> PAGE_BITS;
+                frame_table[i].allocated = FALSE;
+                buddy_free_block(i, 0);
+        }
+        spinlock_release(&frame_table_spinlock);
+        spinlock_release(&c->c_frames_lock);
+}
+
+/*
+ * Give every cpu's cached and zeroed frames back to the buddy
+ * allocator, e.g. to make room for a run, or before resorting to
+ * swap: with several cpus a good many free frames can be sitting in
+ * caches other than ours.
+ */
+static void frame_cache_drain(void)
+{
+        struct cpu *c;
+        unsigned n;
 
-        i = first_frame; j = 0;
+        if (!CURCPU_EXISTS()) {
+                return;
+        }
 
-        while (i < (last_frame - npages) && j < npages) {
-                if (frame_table[i+j].allocated == TRUE) {
-                        i = i + j + 1; /* continue scan after allocated frame */
-                        j = 0;         /* restart the count */
+        for (n = 0; (c = thread_getcpu(n)) != NULL; n++) {
+                frame_cache_drain_cpu(c);
+        }
+}
+
+/*
+ * Pre-zeroed frames. A cpu with nothing to run calls frame_zero_idle()
+ * to clear one free frame at a time into curcpu->c_zeroed, so zero-fill
+ * page faults can skip the bzero. Like the frame cache this is per cpu,
+ * under c_frames_lock, though the bzero itself is done without it.
+ * Zeroed frames are still free memory: frame_cache_get() falls back
+ * on them, and frame_cache_drain() returns them, before anything gets
+ * evicted. Even so, the pool is only refilled from the buddy allocator
+ * while more than ZERO_LOW_WATER frames are free there, so idle cpus
+ * don't soak up the last of memory.
+ */
+#define ZERO_LOW_WATER 64
+
+bool
+frame_zero_idle(void)
+{
+        struct cpu *c;
+        paddr_t paddr;
+        uint32_t i;
+
+        KASSERT(curthread->t_curspl > 0);
+
+        c = curcpu->c_self;
+        spinlock_acquire(&c->c_frames_lock);
+        if (c->c_nzeroed == CPU_ZERO_POOL) {
+                spinlock_release(&c->c_frames_lock);
+                return false;
+        }
+
+        if (c->c_nframes > 0) {
+                paddr = c->c_frames[--c->c_nframes];
+        }
+        else {
+                spinlock_acquire(&frame_table_spinlock);
+                if (free_frames_count > ZERO_LOW_WATER) {
+                        i = buddy_alloc(1);
                 }
                 else {
-                        j = j + 1; /* increment count of free frames */
+                        i = NO_FRAME;
+                }
+                spinlock_release(&frame_table_spinlock);
+                if (i == NO_FRAME) {
+                        spinlock_release(&c->c_frames_lock);
+                        return false;
                 }
+                frame_table[i].refcount = 0;
+                paddr = i << PAGE_BITS;
         }
+        spinlock_release(&c->c_frames_lock);
 
-        if  (j == npages) { /* we exited as we found the number of frames required. */
-                for (j = i; j < i + npages - 1; j++) {
-                        frame_table[j].allocated = TRUE; /* mark frame allocated */
-                        frame_table[j].not_last = TRUE;  /* as a contiguous block */
-                }
-                frame_table[j].allocated = TRUE;
-                frame_table[j].not_last = FALSE;
+        /* the frame is in neither cache while we clear it */
+        bzero((void *) PADDR_TO_KVADDR(paddr), PAGE_SIZE);
 
-                spinlock_release(&frame_table_spinlock);
-                
-                return (paddr_t) (i << PAGE_BITS);
+        /* only we add to the pool, so there is still room */
+        spinlock_acquire(&c->c_frames_lock);
+        c->c_zeroed[c->c_nzeroed++] = paddr;
+        spinlock_release(&c->c_frames_lock);
+
+        return true;
+}
+
+/* take one of this cpu's zeroed frames, if it has any */
+static paddr_t frame_zeroed_get(void)
+{
+        struct cpu *c;
+        uint32_t i;
+
+        if (!CURCPU_EXISTS()) {
+                return (paddr_t) 0;
         }
-        
-        /* Did not find an unallocated contiguous range of frames :-( */
 
-        spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+        c = curcpu->c_self;
+        spinlock_acquire(&c->c_frames_lock);
+        if (c->c_nzeroed == 0) {
+                spinlock_release(&c->c_frames_lock);
+                return (paddr_t) 0;
+        }
+        i = c->c_zeroed[--c->c_nzeroed] >> PAGE_BITS;
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].refcount == 0);
+        frame_init(i);
+        spinlock_release(&c->c_frames_lock);
+
+        return (paddr_t) (i << PAGE_BITS);
+}
+
+vaddr_t
+alloc_zeroed_kpage(void)
+{
+        paddr_t paddr;
+        vaddr_t vaddr;
+
+        paddr = frame_zeroed_get();
+        if (paddr != 0) {
+                return PADDR_TO_KVADDR(paddr);
+        }
+
+        vaddr = alloc_kpages(1);
+        if (vaddr != 0) {
+                bzero((void *) vaddr, PAGE_SIZE);
+        }
+        return vaddr;
 }
 
 static void free_frames(vaddr_t vaddr)
 {
         paddr_t paddr;
-        uint32_t i;
+        uint32_t i, first;
 
         KASSERT(vaddr != (vaddr_t) NULL);
 
@@ -280,18 +693,54 @@ static void free_frames(vaddr_t vaddr)
 
         i = paddr >> PAGE_BITS;
 
+        /*
+         * A single page that nobody else references and the clock
+         * can't be looking at (no owner) can go straight back in
+         * this cpu's cache. Nobody else can change any of that under
+         * us, so it's safe to check without the lock.
+         */
+        if (frame_table[i].allocated == TRUE &&
+            frame_table[i].refcount == 1 &&
+            frame_table[i].not_last == FALSE &&
+            frame_table[i].owner == NULL) {
+                frame_table[i].busy = FALSE;
+                frame_table[i].pinned = FALSE;
+                frame_cache_put(i);
+                return;
+        }
+
         spinlock_acquire(&frame_table_spinlock);
 
-        if (frame_table[i].allocated == FALSE) { /* check for double free error */
+        if (frame_table[i].allocated == FALSE ||
+            frame_table[i].refcount == 0) { /* check for double free error */
                 panic("Double free error!!");
         }
-        
+
+        /* shared frame: just drop this reference */
+        if (frame_table[i].refcount > 1) {
+                frame_table[i].refcount--;
+                spinlock_release(&frame_table_spinlock);
+                return;
+        }
+        frame_table[i].owner = NULL;
+        frame_table[i].busy = FALSE;
+        frame_table[i].pinned = FALSE;
+
+        if (frame_table[i].not_last == FALSE) {
+                spinlock_release(&frame_table_spinlock);
+                frame_cache_put(i);
+                return;
+        }
+
+        frame_table[i].refcount = 0;
+        first = i;
         while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
                 frame_table[i].allocated = FALSE;
                 if (frame_table[i].not_last == TRUE) {
                         i++;
                 }
         }
+        buddy_free_range(first, i - first + 1);
         spinlock_release(&frame_table_spinlock);
 }
         
@@ -300,11 +749,30 @@ vaddr_t
 alloc_kpages(unsigned npages)
 {
         paddr_t paddr;
-        if (npages > 1 ) {
-                paddr = alloc_multiple_frames(npages);
+
+        if (npages == 1) {
+                paddr = frame_cache_get();
+                if (paddr == 0) {
+                        /* other cpus may be holding free frames */
+                        frame_cache_drain();
+                        paddr = frame_cache_get();
+                }
+                /* out of frames: push a user page out to swap and retry */
+                while (paddr == 0 && swap_evict() == 0) {
+                        paddr = frame_cache_get();
+                }
+                if (paddr == 0) {
+                        /* last resort, for the kernel only */
+                        paddr = frame_reserve_get();
+                }
         }
         else {
-                paddr = alloc_one_frame(npages);
+                paddr = alloc_frames(npages);
+                if (paddr == 0) {
+                        /* the frames we need may be sitting in caches */
+                        frame_cache_drain();
+                        paddr = alloc_frames(npages);
+                }
         }
         
 	if (paddr == 0) {
@@ -319,3 +787,239 @@ free_kpages(vaddr_t addr)
         free_frames(addr);
 }
 
+/*
+ * Allocate a frame for a user page: like alloc_kpages(1), or
+ * alloc_zeroed_kpage(), but without touching the kernel's reserve.
+ * Freed with free_kpages() as usual. Returns 0 only when every cpu's
+ * cache has been emptied and nothing more can be swapped out.
+ */
+vaddr_t
+alloc_upage(bool zeroed)
+{
+        paddr_t paddr;
+
+        if (zeroed) {
+                paddr = frame_zeroed_get();
+                if (paddr != 0) {
+                        return PADDR_TO_KVADDR(paddr);
+                }
+        }
+
+        paddr = frame_cache_get();
+        if (paddr == 0) {
+                /* other cpus may be holding free frames */
+                frame_cache_drain();
+                paddr = frame_cache_get();
+        }
+        while (paddr == 0 && swap_evict() == 0) {
+                paddr = frame_cache_get();
+        }
+        if (paddr == 0) {
+                /*
+                 * Frames freed meanwhile may have landed in other
+                 * cpus' caches; look there once more before the
+                 * caller turns to the OOM killer.
+                 */
+                frame_cache_drain();
+                paddr = frame_cache_get();
+        }
+        if (paddr == 0) {
+                return 0;
+        }
+
+        if (zeroed) {
+                bzero((void *) PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+        }
+        return PADDR_TO_KVADDR(paddr);
+}
+
+/*
+ * Reference counting for frames shared copy-on-write between address
+ * spaces. A frame starts with one reference when allocated and
+ * free_kpages() drops one; the frame is only released when the last
+ * reference goes away.
+ */
+void
+frame_incref(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].refcount < 0xffff);
+        frame_table[i].refcount++;
+        /* a shared frame has no single owner and is never evicted */
+        frame_table[i].owner = NULL;
+        spinlock_release(&frame_table_spinlock);
+}
+
+unsigned
+frame_refcount(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+        unsigned count;
+
+        spinlock_acquire(&frame_table_spinlock);
+        count = frame_table[i].refcount;
+        spinlock_release(&frame_table_spinlock);
+
+        return count;
+}
+
+
+/*
+ * Record which address space and virtual page map a user frame. Only
+ * frames with an owner are considered for eviction, so this is called
+ * once the page table entry pointing at the frame is in place. A page
+ * that has just been faulted in counts as referenced.
+ */
+void
+frame_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        /*
+         * No lock needed: the caller holds as's page table lock, so if
+         * the refcount is 1 the frame is ours alone and the clock only
+         * starts looking at it once the owner is visible.
+         */
+        KASSERT(frame_table[i].allocated == TRUE);
+        frame_table[i].referenced = TRUE;
+        if (frame_table[i].refcount == 1) {
+                frame_table[i].vaddr = vaddr & PAGE_FRAME;
+                membar_store_store();
+                frame_table[i].owner = as;
+        }
+}
+
+/*
+ * Called on every TLB refill of a resident page: set the reference
+ * bit the clock hand cleared. A frame whose other sharers have all
+ * gone away has no owner yet; the address space touching it claims it
+ * so it can be evicted again.
+ */
+void
+frame_touch(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        /* unlocked for the same reasons as frame_set_owner() */
+        KASSERT(frame_table[i].allocated == TRUE);
+        frame_table[i].referenced = TRUE;
+        if (frame_table[i].refcount == 1 && frame_table[i].owner == NULL) {
+                frame_table[i].vaddr = vaddr & PAGE_FRAME;
+                membar_store_store();
+                frame_table[i].owner = as;
+        }
+}
+
+/*
+ * Keep a frame from being evicted while the kernel works on it, e.g.
+ * while a page is being read in and the I/O path may itself allocate.
+ */
+void
+frame_pin(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].pinned == FALSE);
+        frame_table[i].pinned = TRUE;
+        spinlock_release(&frame_table_spinlock);
+}
+
+void
+frame_unpin(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].pinned == TRUE);
+        frame_table[i].pinned = FALSE;
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Clock (second chance) replacement. The hand sweeps the frame table
+ * looking at frames with a single owner that are neither pinned nor
+ * already on their way out. A referenced frame has its bit cleared
+ * and gets another lap; the translation is also dropped from this
+ * cpu's TLB, so the next access faults and sets the bit again. (Other
+ * cpus' TLBs are left alone: a page they are using may look idle, but
+ * the eviction itself still shoots their entries down, so this only
+ * costs accuracy.) Two laps are enough to find a victim if one exists.
+ *
+ * The owner's page table lock is taken with lock_tryacquire() while
+ * the frame table is still locked. That keeps the address space from
+ * being destroyed underneath us and means we never sleep on another
+ * process's lock while possibly holding our own; frames of a busy
+ * address space are simply skipped. If the owner is our own address
+ * space and we already hold its lock, *took_lock is set false and the
+ * caller must not release it.
+ *
+ * The victim comes back marked busy; the caller either frees it or
+ * hands it back with frame_unbusy(). Returns 0 if nothing can be
+ * evicted.
+ */
+paddr_t
+frame_pick_victim(struct addrspace **as, vaddr_t *vaddr, bool *took_lock)
+{
+        uint32_t i, n;
+        struct addrspace *owner;
+
+        spinlock_acquire(&frame_table_spinlock);
+        for (n = 0; n < 2 * (last_frame - first_frame); n++) {
+                i = clock_hand;
+                clock_hand++;
+                if (clock_hand >= last_frame) {
+                        clock_hand = first_frame;
+                }
+
+                owner = frame_table[i].owner;
+                if (frame_table[i].allocated == FALSE || owner == NULL ||
+                    frame_table[i].refcount != 1 ||
+                    frame_table[i].pinned == TRUE ||
+                    frame_table[i].busy == TRUE) {
+                        continue;
+                }
+
+                if (frame_table[i].referenced == TRUE) {
+                        /* second chance */
+                        frame_table[i].referenced = FALSE;
+                        vm_tlb_invalidate_local(owner, frame_table[i].vaddr);
+                        continue;
+                }
+
+                if (lock_do_i_hold(owner->pt_lock)) {
+                        *took_lock = false;
+                }
+                else if (lock_tryacquire(owner->pt_lock)) {
+                        *took_lock = true;
+                }
+                else {
+                        continue;
+                }
+
+                frame_table[i].busy = TRUE;
+                *as = owner;
+                *vaddr = frame_table[i].vaddr;
+                spinlock_release(&frame_table_spinlock);
+
+                return (paddr_t) (i << PAGE_BITS);
+        }
+        spinlock_release(&frame_table_spinlock);
+
+        return (paddr_t) 0;
+}
+
+void
+frame_unbusy(paddr_t paddr)
+{
+        uint32_t i = paddr >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(frame_table[i].busy == TRUE);
+        frame_table[i].busy = FALSE;
+        spinlock_release(&frame_table_spinlock);
+}
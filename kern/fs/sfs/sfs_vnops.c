@@ -232,14 +232,15 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Nothing to set up: the VM system pages the file
+ * in and out through sfs_read and sfs_write, so any file will do.
  */
 static
 int
 sfs_mmap(struct vnode *v   /* add stuff as needed */)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 /*
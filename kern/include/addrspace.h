@@ -30,17 +30,45 @@
 #ifndef _ADDRSPACE_H_
 #define _ADDRSPACE_H_
 
-#define NUM_STACK_PAGES 16
+/*
+ * The stack starts out as a single page below USERSTACK and grows down
+ * on demand, as far as the process's RLIMIT_STACK allows. The soft
+ * limit starts at STACK_RLIMIT_CUR and can be raised to
+ * STACK_RLIMIT_MAX, so that much address space is kept clear for it
+ * (mmap and sbrk stay out), plus a gap of STACK_GUARD_PAGES unmapped
+ * pages so running off the end of the stack faults instead of
+ * scribbling on whatever lies below.
+ */
+#define STACK_INITIAL_PAGES 1
+#define STACK_RLIMIT_CUR (2 * 1024 * 1024)
+#define STACK_RLIMIT_MAX (8 * 1024 * 1024)
+#define STACK_GUARD_PAGES 16
+#define STACK_LOWEST (USERSTACK - STACK_RLIMIT_MAX)
 
 /*
  * Address space structure and operations.
  */
 
 
+#include <array.h>
 #include <vm.h>
 #include "opt-dumbvm.h"
+#include "opt-hashpt.h"
 
 struct vnode;
+struct region;
+struct hpte;
+struct shmseg;
+
+/*
+ * Array of regions, kept sorted by address.
+ */
+#ifndef ASINLINE
+#define ASINLINE INLINE
+#endif
+
+DECLARRAY(region, ASINLINE);
+DEFARRAY(region, ASINLINE);
 
 /*
  * Address space - data structure associated with the virtual memory
@@ -61,9 +89,27 @@ struct addrspace {
         paddr_t as_stackpbase;
 
 #else
-        struct region *region_list;
+        struct regionarray regions;     /* sorted by vaddr, disjoint */
+        struct region *last_region;     /* last region found; may be NULL */
+        struct region *heap;            /* grows with sbrk; NULL until loaded */
+        struct region *stack;           /* grows down on faults; may be NULL */
+        vaddr_t heap_break;             /* current end of the heap */
+#if OPT_HASHPT
+        struct hpte *hpt_entries;       /* all our entries in the hash table */
+#else
         paddr_t **pagetable;
+        uint16_t *pt_used;      /* entries in use in each level 2 table */
+#endif
         struct lock *pt_lock;
+        unsigned rss;                   /* resident pages, for the OOM killer */
+        bool oom_killed;                /* picked by it; exits soon */
+        struct addrspace *all_next;     /* list of every address space */
+        struct addrspace **all_prev;
+
+        /* TLB tag; only meaningful while asid_generation is current */
+        unsigned asid;
+        unsigned asid_generation;
+        uint32_t asid_cpus;     /* cpus that may hold entries for asid */
 #endif
 };
 
@@ -74,7 +120,17 @@ struct region {
         bool writeable;
         bool executable;
         bool old_writeable;
-        struct region *next;
+
+        /* backing file for demand paging; vnode is NULL if anonymous */
+        struct vnode *vnode;
+        off_t file_offset;      /* file offset of the byte at file_vaddr */
+        vaddr_t file_vaddr;     /* where the file data begins in memory */
+        size_t filesize;        /* bytes backed by the file; rest is zero */
+
+        bool mmapped;           /* made by mmap(), can be munmap()ed */
+        bool shared;            /* writes go back to vnode; see as_mmap */
+        int advice;             /* MADV_NORMAL, _RANDOM or _SEQUENTIAL */
+        struct shmseg *shm;     /* attached segment, or NULL */
 };
 
 
@@ -111,10 +167,48 @@ struct region {
  *    as_complete_load - this is called when loading from an executable
  *                is complete.
  *
+ *    as_define_backing - attach a range of an executable to the region
+ *                containing VADDR, so vm_fault can page it in lazily.
+ *
+ *    as_find_region - return the region containing VADDR, or NULL.
+ *                Binary search, after checking the last one found.
+ *
+ *    as_sbrk   - move the heap break by AMOUNT bytes (up or down) and
+ *                hand back the old break. Memory given back is freed
+ *                immediately.
+ *
+ *    as_mmap   - place a new region of LENGTH bytes between the heap
+ *                and the stack, backed by FILESIZE bytes of V from
+ *                OFFSET (or anonymous if V is NULL), and hand back its
+ *                address. Nothing is read until it is touched.
+ *
+ *    as_munmap - remove the mmap()ed region starting at VADDR, writing
+ *                its modified pages back first if it is shared.
+ *
+ *    as_shmat  - map shared memory segment ID between the heap and the
+ *                stack, like as_mmap, and hand back its address.
+ *
+ *    as_shmdt  - remove the segment attached at VADDR.
+ *
+ *    as_mprotect - change the permissions of [VADDR, VADDR+LEN),
+ *                splitting regions at the ends of the range.
+ *
+ *    as_madvise - act on (WILLNEED, DONTNEED) or record (NORMAL,
+ *                RANDOM, SEQUENTIAL) advice for [VADDR, VADDR+LEN).
+ *
+ *    as_sync   - write back the modified pages of every shared mapping
+ *                of V.
+ *
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_grow_stack - extend the stack down to VADDR if it is allowed
+ *                to get that big (LIMIT bytes) without coming within
+ *                the guard gap of the region below. Returns the stack,
+ *                or NULL if VADDR isn't the stack's. Called from
+ *                vm_fault with the page table lock held.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -132,7 +226,27 @@ int               as_define_region(struct addrspace *as,
                                    int executable);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
+int               as_define_backing(struct addrspace *as, vaddr_t vaddr,
+                                    struct vnode *v, off_t offset,
+                                    size_t filesize);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+struct region    *as_grow_stack(struct addrspace *as, vaddr_t vaddr,
+                                size_t limit);
+struct region    *as_find_region(struct addrspace *as, vaddr_t vaddr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, size_t length, int prot,
+                          struct vnode *v, off_t offset, size_t filesize,
+                          bool shared, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr);
+int               as_shmat(struct addrspace *as, int id, int prot,
+                           vaddr_t *ret);
+int               as_shmdt(struct addrspace *as, vaddr_t vaddr);
+int               as_mprotect(struct addrspace *as, vaddr_t vaddr,
+                              size_t len, int prot);
+int               as_madvise(struct addrspace *as, vaddr_t vaddr,
+                             size_t len, int advice);
+int               as_sync(struct addrspace *as, struct vnode *v);
 
 
 /*
@@ -36,6 +36,10 @@
 
 #include <kern/time.h>
 
+struct thread;
+struct wchan;
+struct spinlock;
+
 
 /*
  * hardclock() is called on every CPU HZ times a second, possibly only
@@ -79,5 +83,77 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * clocknanosleep() suspends execution for at least DURATION, like
+ * userlevel nanosleep(2). It wakes on the first hardclock after that
+ * much time has passed, so it oversleeps by at most 1/HZ seconds.
+ */
+void clocknanosleep(const struct timespec *duration);
+
+/*
+ * Timers, kept in a hashed timing wheel turned by hardclock() on
+ * CPU 0.
+ *
+ * timer_init - set up TM to call FUNC(DATA) when it fires.
+ *
+ * timer_start - arm TM (which must not be pending) to fire at the
+ *               first hardclock at least TIMEOUT from now. Timeouts
+ *               shorter than a hardclock fire on the next one.
+ *
+ * timer_stop - disarm TM. Returns true if it hadn't fired yet. Once
+ *              this returns the function isn't running either, so
+ *              TM can be freed.
+ *
+ * The function is called from the timer interrupt with the timer
+ * lock held, so it must not sleep or use timer_start/timer_stop.
+ * The timer lock comes before every other spinlock; don't call
+ * timer_start or timer_stop holding one.
+ */
+struct timer {
+	struct timer *tm_next;		/* wheel slot list */
+	struct timer **tm_prev;
+	unsigned tm_expires;		/* hardclock it's filed under */
+	struct timespec tm_deadline;	/* not to fire before this */
+	bool tm_pending;
+	void (*tm_func)(void *);
+	void *tm_data;
+};
+
+void timer_init(struct timer *tm, void (*func)(void *), void *data);
+void timer_start(struct timer *tm, const struct timespec *timeout);
+bool timer_stop(struct timer *tm);
+
+/*
+ * Timed sleeps on a wait channel, for building timeouts into things
+ * that sleep on one. The sleeper does:
+ *
+ *	timedwait_start(&tw, wc, lk, timeout);
+ *	spinlock_acquire(lk);
+ *	while (!condition && !tw.tw_expired) {
+ *		wchan_sleep(wc, lk);
+ *	}
+ *	spinlock_release(lk);
+ *	timedwait_stop(&tw);
+ *
+ * When the timeout expires, tw_expired is set under LK and the sleeper,
+ * and only the sleeper, is woken if it is asleep on WC. tw_fired is
+ * set only if that wakeup is what took it off WC: if it was already
+ * woken by someone else, tw_fired stays false, so a sleeper that wants
+ * to know which wakeup it got (such as cv_wait_timeout) doesn't lose
+ * the other one.
+ */
+struct timedwait {
+	struct timer tw_timer;
+	struct thread *tw_thread;
+	struct wchan *tw_wchan;
+	struct spinlock *tw_lock;
+	bool tw_expired;		/* protected by tw_lock */
+	bool tw_fired;			/* protected by tw_lock */
+};
+
+void timedwait_start(struct timedwait *tw, struct wchan *wc,
+		     struct spinlock *lk, const struct timespec *timeout);
+void timedwait_stop(struct timedwait *tw);
+
 
 #endif /* _CLOCK_H_ */
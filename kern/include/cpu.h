@@ -33,7 +33,17 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
-#include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX, struct tlbshadow */
+
+/*
+ * Number of free frames each cpu keeps to itself, and how many move
+ * between it and the frame allocator at a time.
+ */
+#define CPU_FRAME_CACHE 16
+#define CPU_FRAME_BATCH 8
+
+/* Number of zero-filled frames each cpu prepares while idle. */
+#define CPU_ZERO_POOL 16
 
 
 /*
@@ -61,6 +71,19 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned c_asid;		/* Address space ID in the MMU */
+	unsigned c_asid_generation;	/* ASID generation TLB is valid for */
+	struct tlbshadow c_tlb;		/* What the TLB holds */
+
+	/*
+	 * Normally used only by this cpu, but drained by others when
+	 * memory runs short. Protected by c_frames_lock.
+	 */
+	paddr_t c_frames[CPU_FRAME_CACHE]; /* Free frames for this cpu */
+	unsigned c_nframes;		/* Number of them */
+	paddr_t c_zeroed[CPU_ZERO_POOL]; /* Free frames already zeroed */
+	unsigned c_nzeroed;		/* Number of them */
+	struct spinlock c_frames_lock;
 
 	/*
 	 * Accessed by other cpus.
@@ -155,6 +178,9 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_cpus sends it to each CPU whose bit (1 << c_number)
+ * is set in CPUS, except the current one, and returns how many CPUs
+ * that was.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +195,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_cpus(uint32_t cpus,
+			      const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,27 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Flags for the UNSW mmap(), mprotect() and madvise(), shared between
+ * the kernel and <unistd.h>.
+ *
+ * There is no separate flags argument, so MAP_PRIVATE is or'd into
+ * prot. A mapping of a file is shared unless MAP_PRIVATE is given:
+ * writes go back to the file on munmap(), fsync() or exit. A mapping
+ * with fd -1 is anonymous zero-filled memory and always private.
+ */
+
+#define PROT_READ     1      /* Pages may be read */
+#define PROT_WRITE    2      /* Pages may be written */
+#define PROT_EXEC     4      /* Pages may be executed */
+
+#define MAP_PRIVATE   0x100  /* Writes are not carried through to the file */
+
+/* Advice for madvise() */
+#define MADV_NORMAL      0   /* No special treatment */
+#define MADV_RANDOM      1   /* Expect random access; don't read around */
+#define MADV_SEQUENTIAL  2   /* Expect sequential access; read ahead */
+#define MADV_WILLNEED    3   /* Will be needed soon; page it in now */
+#define MADV_DONTNEED    4   /* Not needed; release the memory now */
+
+#endif /* _KERN_MMAN_H_ */
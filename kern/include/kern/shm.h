@@ -0,0 +1,25 @@
+#ifndef _KERN_SHM_H_
+#define _KERN_SHM_H_
+
+/*
+ * Flags for the UNSW System V style shared memory calls, shared
+ * between the kernel and <unistd.h>.
+ *
+ * shmget() finds or creates the segment named by a key and returns
+ * its id; shmat() maps the whole segment with the given PROT_* bits
+ * and returns its address; shmdt() undoes shmat(). Attachments are
+ * inherited across fork. A segment removed with shmctl(IPC_RMID)
+ * can no longer be found, and goes away when the last process
+ * detaches from it.
+ */
+
+#define IPC_PRIVATE   0      /* Key for a new segment with no name */
+
+/* shmget() flags */
+#define IPC_CREAT     0x200  /* Create the segment if it doesn't exist */
+#define IPC_EXCL      0x400  /* With IPC_CREAT, fail if it exists */
+
+/* shmctl() commands */
+#define IPC_RMID      0      /* Remove the segment */
+
+#endif /* _KERN_SHM_H_ */
@@ -59,7 +59,7 @@
 #define SYS_mmap         8
 #define SYS_munmap       9
 #define SYS_mprotect     10
-//#define SYS_madvise    11
+#define SYS_madvise      11
 //#define SYS_mincore    12
 //#define SYS_mlock      13
 //#define SYS_munlock    14
@@ -86,13 +86,13 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage    35
 //                              (resource limits)
-//#define SYS_getrlimit  36
-//#define SYS_setrlimit  37
+#define SYS_getrlimit    36
+#define SYS_setrlimit    37
 //                              (process priority control)
-//#define SYS_getpriority 38
-//#define SYS_setpriority 39
+#define SYS_getpriority  38
+#define SYS_setpriority  39
 //                              (process groups, sessions, and job control)
 //#define SYS_getpgid    40
 //#define SYS_setpgid    41
@@ -196,6 +196,14 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+//                              (shared memory)
+#define SYS_shmget       121
+#define SYS_shmat        122
+#define SYS_shmdt        123
+#define SYS_shmctl       124
+//                              (cpu affinity)
+#define SYS_sched_setaffinity 125
+#define SYS_sched_getaffinity 126
 
 /*CALLEND*/
 
@@ -36,6 +36,8 @@
  * Note: curproc is defined by <current.h>.
  */
 
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
 
@@ -60,6 +62,14 @@ struct proc {
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	unsigned p_minflt;		/* faults resolved without I/O */
+	unsigned p_majflt;		/* faults that read from disk */
+	unsigned p_faultaround;		/* TLB entries preloaded on faults */
+	struct rlimit p_stacklimit;	/* RLIMIT_STACK; changed only by
+					   the process itself */
+
+	/* Scheduling */
+	int p_nice;			/* setpriority(); likewise */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
@@ -0,0 +1,42 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+/*
+ * Shared memory segments (vm/shm.c).
+ *
+ * A segment is a run of zero-filled pages that any number of regions
+ * can map. Each page is one frame, allocated when first touched and
+ * held by the segment until it is destroyed, so every process sees
+ * the same frame. A frame is also referenced by each page table entry
+ * that maps it, which keeps it from being evicted while it is in use.
+ *
+ *    shm_bootstrap - set up the segment table.
+ *
+ *    shm_get       - look up the segment for KEY, creating one of SIZE
+ *                    bytes if FLAGS say so, and hand back its id.
+ *
+ *    shm_attach    - get the segment with id ID for a new region and
+ *                    its size in bytes.
+ *
+ *    shm_incref    - another region points at SEG (fork, split).
+ *
+ *    shm_detach    - a region pointing at SEG has gone away.
+ *
+ *    shm_remove    - forget the name of segment ID; it is destroyed
+ *                    once nothing is attached.
+ *
+ *    shm_getpage   - hand back the frame for page INDEX of SEG with a
+ *                    reference added for the caller's page table.
+ */
+
+struct shmseg;
+
+void shm_bootstrap(void);
+int shm_get(int key, size_t size, int flags, int *id);
+int shm_attach(int id, struct shmseg **ret, size_t *size);
+void shm_incref(struct shmseg *seg);
+void shm_detach(struct shmseg *seg);
+int shm_remove(int id);
+int shm_getpage(struct shmseg *seg, unsigned index, paddr_t *ret);
+
+#endif /* _SHM_H_ */
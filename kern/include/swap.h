@@ -0,0 +1,38 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space for the VM system.
+ *
+ * Pages are paged out to a raw disk (SWAP_DEVICE), one page per slot.
+ * A swapped-out page table entry holds its slot number in place of
+ * the frame number, see PTE_SWAPPED in <vm.h>.
+ *
+ *    swap_bootstrap - open the swap device. If there isn't one the
+ *                     system runs with physical memory only.
+ *
+ *    swap_out       - write the contents of FRAME to a free slot and
+ *                     hand back the slot number.
+ *
+ *    swap_in        - read SLOT into FRAME and release the slot.
+ *
+ *    swap_copy      - duplicate SLOT into a new slot (fork of a page
+ *                     that is currently swapped out).
+ *
+ *    swap_free      - release SLOT without reading it.
+ *
+ *    swap_evict     - pick a victim user page and push it out to
+ *                     swap, freeing its frame. Returns ENOMEM if
+ *                     there is nothing that can be evicted.
+ */
+
+#define SWAP_DEVICE "lhd1raw:"
+
+void swap_bootstrap(void);
+int swap_out(paddr_t frame, unsigned *slot);
+int swap_in(unsigned slot, paddr_t frame);
+int swap_copy(unsigned slot, unsigned *newslot);
+void swap_free(unsigned slot);
+int swap_evict(void);
+
+#endif /* _SWAP_H_ */
@@ -37,6 +37,8 @@
 
 #include <spinlock.h>
 
+struct timespec; /* in <kern/time.h> */
+
 /*
  * Dijkstra-style semaphore.
  *
@@ -58,9 +60,13 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ *     P_timeout: like P, but give up after TIMEOUT (see timer_start in
+ *                <clock.h>) and return ETIMEDOUT without decrementing.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+int P_timeout(struct semaphore *, const struct timespec *timeout);
 
 
 /*
@@ -91,12 +97,16 @@ void lock_destroy(struct lock *);
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
+ *    lock_tryacquire - Get the lock if it is free and return true;
+ *                   return false without sleeping if it is held. Unlike
+ *                   lock_acquire this may be called with spinlocks held.
  *
  * These operations must be atomic. You get to write them.
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
+bool lock_tryacquire(struct lock *);
 
 
 /*
@@ -129,13 +139,19 @@ void cv_destroy(struct cv *);
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
- * For all three operations, the current thread must hold the lock passed
+ *    cv_wait_timeout - Like cv_wait, but also wake up after TIMEOUT if
+ *                   not signalled first, and return ETIMEDOUT if so.
+ *                   The lock is re-acquired either way.
+ *
+ * For all these operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_wait_timeout(struct cv *cv, struct lock *lock,
+		    const struct timespec *timeout);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
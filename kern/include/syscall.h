@@ -64,12 +64,30 @@ void exec_bootstrap(void);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
 int sys_getpid(pid_t *retval);
+int sys_getrusage(int who, userptr_t usage);
+int sys_getrlimit(int resource, userptr_t rlp);
+int sys_setrlimit(int resource, const_userptr_t rlp);
+int sys_getpriority(int which, pid_t who, int *retval);
+int sys_setpriority(int which, pid_t who, int prio);
+int sys_sched_setaffinity(pid_t pid, uint32_t mask);
+int sys_sched_getaffinity(pid_t pid, userptr_t mask);
+
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(size_t length, int prot, int fd, off_t offset, vaddr_t *retval);
+int sys_munmap(vaddr_t addr);
+int sys_mprotect(vaddr_t addr, size_t len, int prot);
+int sys_madvise(vaddr_t addr, size_t len, int advice);
+int sys_shmget(int key, size_t size, int flags, int *retval);
+int sys_shmat(int shmid, int prot, vaddr_t *retval);
+int sys_shmdt(vaddr_t addr);
+int sys_shmctl(int shmid, int cmd);
 
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
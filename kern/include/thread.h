@@ -55,6 +55,21 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/*
+ * Multi-level feedback queue. A thread at level N gets a quantum of
+ * MLFQ_QUANTUM << N hardclocks, scaled by its nice weight, before it
+ * drops to level N+1.
+ */
+#define MLFQ_LEVELS 4
+#define MLFQ_QUANTUM 2
+
+/*
+ * A thread that ran on a CPU within this many hardclocks probably
+ * still has its working set in that CPU's cache, so idle CPUs look
+ * for something else to steal first.
+ */
+#define CACHE_HOT_HARDCLOCKS 2
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -72,6 +87,7 @@ struct thread {
 	 */
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
+	struct wchan *t_wchan;		/* Wait channel, if on its list */
 	threadstate_t t_state;		/* State this thread is in */
 
 	/*
@@ -102,6 +118,17 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduler fields. See schedule() in thread.c.
+	 */
+	unsigned t_priority;		/* MLFQ level; 0 runs first */
+	unsigned t_ticks;		/* hardclocks used at this level */
+	int t_nice;			/* copy of the process's p_nice */
+	struct cpu *t_lastcpu;		/* where it last ran, or NULL */
+	unsigned t_lastran;		/* t_lastcpu's c_hardclocks when
+					   last switched out */
+	uint32_t t_affinity;		/* cpus (by c_number) it may use */
+
 	/*
 	 * Public fields
 	 */
@@ -158,6 +185,39 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for a hardclock. Returns true if it has
+ * used up its quantum or a higher priority thread is waiting, so it
+ * should yield. Called from the timer interrupt.
+ */
+bool thread_tick(void);
+
+/*
+ * Change a thread's nice value, which weights its quantum and keeps
+ * it from rising above a corresponding level. NICE must be between
+ * PRIO_MIN and PRIO_MAX.
+ */
+void thread_setnice(struct thread *t, int nice);
+
+/*
+ * Restrict a thread to the CPUs in MASK (bit N is the CPU whose
+ * c_number is N), which must include at least one that exists. A
+ * queued thread is moved by thread_consider_migration, a sleeping one
+ * when it is woken. A running one moves at a context switch, as soon
+ * as its CPU has something else to run; see thread_switch.
+ */
+void thread_setaffinity(struct thread *t, uint32_t mask);
+
+/*
+ * The affinity mask with every CPU in it.
+ */
+uint32_t thread_allcpus_mask(void);
+
+/*
+ * CPU number NUM, or NULL past the last one.
+ */
+struct cpu *thread_getcpu(unsigned num);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
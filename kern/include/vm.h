@@ -37,20 +37,69 @@
  */
  #define PT_SIZE 1024
 
+/* 2-lvl translation virtual address: |10 bits (first lvl)| 10 bits(second level)| 12 bits(offset)| */
+#define PT1_INDEX(vaddr) ((vaddr) >> 22)
+#define PT2_INDEX(vaddr) (((vaddr) >> 12) & (PT_SIZE - 1))
+
+/*
+ * A page table entry is either 0 (never touched), a resident page
+ * (frame | TLBLO_DIRTY | TLBLO_VALID, as loaded into the TLB), or a
+ * page out in swap: the slot number where the frame number would be,
+ * TLBLO_VALID clear and PTE_SWAPPED set.
+ */
+#define PTE_SWAPPED 0x00000001
+#define PTE_IS_SWAPPED(pte) (((pte) & PTE_SWAPPED) != 0)
+#define PTE_SWAP_SLOT(pte) ((pte) >> 12)
+#define PTE_MKSWAP(slot) (((paddr_t)(slot) << 12) | PTE_SWAPPED)
+
 
 #include <machine/vm.h>
 
+struct addrspace;
+struct region;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
 #define VM_FAULT_READONLY    2    /* A write to a readonly page was attempted*/
 
 
+/*
+ * Page tables (vm/pagetable.c). Two-level per address space by default;
+ * with options hashpt, one hash table for the whole system keyed by
+ * address space and page. Apart from pt_create and pt_destroy these
+ * are called with the address space's pt_lock held.
+ *
+ *     pt_bootstrap - set up global state; called from vm_bootstrap.
+ *     pt_create    - make an empty table for a new address space.
+ *     pt_destroy   - release every entry (vm_free_pte) and the table.
+ *     pt_lookup    - the entry for vaddr, or NULL if there isn't one.
+ *     pt_alloc     - the entry for vaddr, made (empty) if need be;
+ *                    NULL if out of memory.
+ *     pt_release   - an entry from pt_alloc has been set back to 0 and
+ *                    may be thrown away.
+ *     pt_next      - the first non-empty entry at or after *vaddr and
+ *                    below end, with *vaddr moved to its page; NULL if
+ *                    there is none.
+ *     pt_copy      - fill newas's table from old's with vm_copy_pte.
+ */
+void pt_bootstrap(void);
+int pt_create(struct addrspace *as);
+void pt_destroy(struct addrspace *as);
+paddr_t *pt_lookup(struct addrspace *as, vaddr_t vaddr);
+paddr_t *pt_alloc(struct addrspace *as, vaddr_t vaddr);
+void pt_release(struct addrspace *as, vaddr_t vaddr);
+paddr_t *pt_next(struct addrspace *as, vaddr_t *vaddr, vaddr_t end);
+int pt_copy(struct addrspace *old, struct addrspace *newas);
+
 /* Initialization function */
 void vm_bootstrap(void);
-int vm_add_l1_entry(paddr_t **page_table, uint32_t pt1_index);
-int vm_add_l2_entry(paddr_t **page_table, uint32_t pt1_index, uint32_t pt2_index, uint32_t dirty);
-int vm_copy_pt(paddr_t **old_pt, paddr_t **new_pt);
+int vm_copy_pte(paddr_t *oldpte, paddr_t *newpte);
+void vm_free_pte(paddr_t pte);
+void vm_unmap_range(struct addrspace *as, vaddr_t start, vaddr_t end);
+void vm_protect_range(struct addrspace *as, vaddr_t start, vaddr_t end);
+int vm_writeback(struct addrspace *as, struct region *reg);
+int vm_prefault(struct addrspace *as, struct region *reg, vaddr_t vaddr);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
@@ -58,10 +107,69 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Allocate a frame for a user page, zero-filled if ZEROED. Unlike
+ * alloc_kpages this never dips into the frames kept back for the
+ * kernel. Freed with free_kpages.
+ */
+vaddr_t alloc_upage(bool zeroed);
+
+/*
+ * Out of memory. vm_alloc_upage is alloc_upage with the OOM killer
+ * behind it: if nothing can be had, the process with the largest
+ * resident set loses its pages and is marked to exit, which
+ * vm_oom_killed tells it on the way in from user mode. Every address
+ * space is registered with the killer while it exists.
+ */
+vaddr_t vm_alloc_upage(bool zeroed);
+bool vm_oom_killed(void);
+void vm_oom_register(struct addrspace *as);
+void vm_oom_unregister(struct addrspace *as);
+
+/*
+ * Allocate one page already filled with zeroes. Idle cpus keep a few
+ * of these ready (frame_zero_idle), so page faults rarely have to
+ * clear a page themselves.
+ */
+vaddr_t alloc_zeroed_kpage(void);
+bool frame_zero_idle(void);
+
+/*
+ * Called by a cpu with nothing to run, with interrupts off. Does a
+ * short piece of background work and returns true, or returns false
+ * if there is nothing to do and the cpu may go to sleep.
+ */
+bool vm_idle(void);
+
+/* Share a frame copy-on-write; free_kpages drops one reference */
+void frame_incref(paddr_t paddr);
+unsigned frame_refcount(paddr_t paddr);
+
+/*
+ * Coremap: reverse mapping of user frames plus the state the clock
+ * replacement policy needs to pick pages to swap out.
+ */
+void frame_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void frame_touch(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void frame_pin(paddr_t paddr);
+void frame_unpin(paddr_t paddr);
+paddr_t frame_pick_victim(struct addrspace **as, vaddr_t *vaddr, bool *took_lock);
+void frame_unbusy(paddr_t paddr);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Address space IDs. Each address space is tagged with an ASID from a
+ * small pool, so switching between processes doesn't flush the TLB;
+ * see vm_asid_activate.
+ */
+void vm_asid_activate(struct addrspace *as);
+void vm_asid_retire(struct addrspace *as);
+
 /*helper*/
 void load_tlb(uint32_t entryHi, uint32_t entryLo);
+void vm_tlb_invalidate(struct addrspace *as, vaddr_t vaddr);
+void vm_tlb_invalidate_local(struct addrspace *as, vaddr_t vaddr);
 
 #endif /* _VM_H_ */
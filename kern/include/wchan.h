@@ -36,6 +36,7 @@
 
 
 struct spinlock; /* in spinlock.h */
+struct thread; /* in thread.h */
 struct wchan; /* Opaque */
 
 /*
@@ -76,5 +77,13 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Wake up thread T if it is sleeping on the wait channel, and do
+ * nothing if it isn't. Returns true if T was woken. The associated
+ * spinlock should be locked.
+ */
+bool wchan_wakethread(struct wchan *wc, struct spinlock *lk,
+		      struct thread *t);
+
 
 #endif /* _WCHAN_H_ */
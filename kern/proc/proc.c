@@ -90,6 +90,14 @@ proc_create(const char *name)
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	proc->p_minflt = 0;
+	proc->p_majflt = 0;
+	proc->p_faultaround = 0;
+	proc->p_stacklimit.rlim_cur = STACK_RLIMIT_CUR;
+	proc->p_stacklimit.rlim_max = STACK_RLIMIT_MAX;
+
+	/* Scheduling */
+	proc->p_nice = 0;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
@@ -292,6 +300,8 @@ proc_fork(struct proc **ret)
 #endif
 
 	/* VM fields */
+	newproc->p_stacklimit = curproc->p_stacklimit;
+	newproc->p_nice = curproc->p_nice;
 	as = proc_getas();
 	if (as != NULL) {
 		result = as_copy(as, &newproc->p_addrspace);
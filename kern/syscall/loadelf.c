@@ -73,6 +73,10 @@
  * executable whose load address is in kernel space. If you should
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
+ *
+ * Without dumbvm the segment is demand paged: as_define_region has
+ * already rejected regions outside kuseg, so only the backing file
+ * range is recorded here.
  */
 static
 int
@@ -81,6 +85,25 @@ load_segment(struct addrspace *as, struct vnode *v,
 	     size_t memsize, size_t filesize,
 	     int is_executable)
 {
+#if !OPT_DUMBVM
+	(void)memsize;
+	(void)is_executable;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	/*
+	 * Nothing is read here. The segment is attached to its region
+	 * and vm_fault reads each page from the executable the first
+	 * time it is touched, zero-filling the part past FILESIZE.
+	 */
+	return as_define_backing(as, vaddr, v, offset, filesize);
+#else
 	struct iovec iov;
 	struct uio u;
 	int result;
@@ -143,6 +166,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 #endif
 
 	return result;
+#endif /* OPT_DUMBVM */
 }
 
 /*
@@ -47,7 +47,9 @@
 #include <vnode.h>
 #include <openfile.h>
 #include <filetable.h>
+#include <addrspace.h>
 #include <syscall.h>
+#include "opt-dumbvm.h"
 
 /*
  * Note: if you are receiving this code as a patch to integrate with
@@ -387,6 +389,15 @@ sys_fsync(int fd)
 	 * and we're not using any of its non-constant fields.
 	 */
 
+#if !OPT_DUMBVM
+	/* changes made through our mappings of it count too */
+	err = as_sync(proc_getas(), file->of_vnode);
+	if (err) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return err;
+	}
+#endif
+
 	err = VOP_FSYNC(file->of_vnode);
 	filetable_put(curproc->p_filetable, fd, file);
 	return err;
@@ -33,10 +33,14 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <kern/wait.h>
 #include <lib.h>
 #include <machine/trapframe.h>
 #include <clock.h>
+#include <cpu.h>
+#include <synch.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
@@ -58,6 +62,178 @@ sys_getpid(pid_t *retval)
 	return 0;
 }
 
+/*
+ * sys_getrusage
+ * Only the fault counters are kept, and only for the caller itself.
+ */
+int
+sys_getrusage(int who, userptr_t usage)
+{
+	struct rusage ru;
+
+	if (who != RUSAGE_SELF) {
+		return EINVAL;
+	}
+
+	bzero(&ru, sizeof(ru));
+	ru.ru_minflt = curproc->p_minflt;
+	ru.ru_majflt = curproc->p_majflt;
+	ru.ru_nfaultaround = curproc->p_faultaround;
+	return copyout(&ru, usage, sizeof(ru));
+}
+
+/*
+ * sys_getrlimit
+ * Only RLIMIT_STACK is implemented; see as_grow_stack.
+ */
+int
+sys_getrlimit(int resource, userptr_t rlp)
+{
+	if (resource != RLIMIT_STACK) {
+		return EINVAL;
+	}
+	return copyout(&curproc->p_stacklimit, rlp, sizeof(struct rlimit));
+}
+
+/*
+ * sys_setrlimit
+ * The hard limit can be lowered but never raised, and the stack
+ * can't be allowed more than the address space kept clear for it.
+ * Lowering the soft limit doesn't shrink a stack that is bigger
+ * already, it just stops it growing.
+ */
+int
+sys_setrlimit(int resource, const_userptr_t rlp)
+{
+	struct rlimit rl;
+	int result;
+
+	if (resource != RLIMIT_STACK) {
+		return EINVAL;
+	}
+	result = copyin(rlp, &rl, sizeof(rl));
+	if (result) {
+		return result;
+	}
+	if (rl.rlim_cur > rl.rlim_max) {
+		return EINVAL;
+	}
+	if (rl.rlim_max > curproc->p_stacklimit.rlim_max) {
+		return EPERM;
+	}
+	curproc->p_stacklimit = rl;
+	return 0;
+}
+
+/*
+ * sys_getpriority
+ * Only PRIO_PROCESS, and only for the caller itself; there's no way
+ * to find another process from its pid. Children inherit the nice
+ * value, so a batch job can still be started niced.
+ */
+int
+sys_getpriority(int which, pid_t who, int *retval)
+{
+	if (which != PRIO_PROCESS) {
+		return EINVAL;
+	}
+	if (who != 0 && who != curproc->p_pid) {
+		return ESRCH;
+	}
+	*retval = curproc->p_nice;
+	return 0;
+}
+
+/*
+ * sys_setpriority
+ * Same restrictions as getpriority. Out of range values are clamped,
+ * as POSIX says. There are no users to protect from each other, so
+ * anyone can lower their nice value too.
+ */
+int
+sys_setpriority(int which, pid_t who, int prio)
+{
+	unsigned i, num;
+
+	if (which != PRIO_PROCESS) {
+		return EINVAL;
+	}
+	if (who != 0 && who != curproc->p_pid) {
+		return ESRCH;
+	}
+	if (prio < PRIO_MIN) {
+		prio = PRIO_MIN;
+	}
+	if (prio > PRIO_MAX) {
+		prio = PRIO_MAX;
+	}
+
+	lock_acquire(curproc->p_threadslock);
+	curproc->p_nice = prio;
+	num = threadarray_num(&curproc->p_threads);
+	for (i = 0; i < num; i++) {
+		thread_setnice(threadarray_get(&curproc->p_threads, i), prio);
+	}
+	lock_release(curproc->p_threadslock);
+	return 0;
+}
+
+/*
+ * sys_sched_setaffinity
+ * Bit N of MASK allows CPU N. Bits for CPUs that don't exist are
+ * ignored, but at least one that does must be set. As for
+ * setpriority, PID can only be the caller.
+ *
+ * Threads that aren't running are only ever queued on an allowed CPU
+ * from now on. The caller, if it is running on a CPU it has just been
+ * barred from, leaves it at the first context switch that finds that
+ * CPU something else to run, either queued there or stolen from a
+ * busier one; it yields here and retries every tick after. A CPU can't
+ * hand over the thread whose stack it is on, so with nothing else to
+ * run anywhere the caller carries on where it is until there is.
+ */
+int
+sys_sched_setaffinity(pid_t pid, uint32_t mask)
+{
+	unsigned i, num;
+
+	if (pid != 0 && pid != curproc->p_pid) {
+		return ESRCH;
+	}
+	mask &= thread_allcpus_mask();
+	if (mask == 0) {
+		return EINVAL;
+	}
+
+	lock_acquire(curproc->p_threadslock);
+	num = threadarray_num(&curproc->p_threads);
+	for (i = 0; i < num; i++) {
+		thread_setaffinity(threadarray_get(&curproc->p_threads, i),
+				   mask);
+	}
+	lock_release(curproc->p_threadslock);
+
+	if ((mask & ((uint32_t)1 << curcpu->c_number)) == 0) {
+		thread_yield();
+	}
+	return 0;
+}
+
+/*
+ * sys_sched_getaffinity
+ */
+int
+sys_sched_getaffinity(pid_t pid, userptr_t mask)
+{
+	uint32_t m;
+
+	if (pid != 0 && pid != curproc->p_pid) {
+		return ESRCH;
+	}
+	m = curthread->t_affinity;
+	return copyout(&m, mask, sizeof(m));
+}
+
 /*
  * sys__exit()
  *
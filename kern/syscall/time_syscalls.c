@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +57,31 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in REQ. Nothing can interrupt the sleep, so the
+ * time left in REM, if wanted, is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t req, userptr_t rem)
+{
+	struct timespec ts;
+	int result;
+
+	result = copyin(req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	clocknanosleep(&ts);
+
+	if (rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, rem, sizeof(ts));
+	}
+	return result;
+}
@@ -0,0 +1,219 @@
+/*
+ * Memory management syscalls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/shm.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <addrspace.h>
+#include <shm.h>
+#include <syscall.h>
+
+
+/*
+ * sys_sbrk
+ * Move the end of the heap and return where it used to be. The
+ * address space does the work; see as_sbrk.
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_sbrk(as, amount, retval);
+}
+
+/*
+ * sys_mmap
+ * Map LENGTH bytes of FD from OFFSET, or fresh zeroed memory if FD is
+ * -1. Nothing is read here; vm_fault pages the file in as it is
+ * touched, and shared mappings are written back by munmap, fsync or
+ * exit. The file may be shorter than the mapping: the rest is zero
+ * and isn't written back.
+ */
+int
+sys_mmap(size_t length, int prot, int fd, off_t offset, vaddr_t *retval)
+{
+	struct addrspace *as;
+	struct openfile *file;
+	struct stat st;
+	size_t filesize;
+	bool shared;
+	int err;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	if (length == 0 ||
+	    (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC | MAP_PRIVATE))) {
+		return EINVAL;
+	}
+
+	if (fd == -1) {
+		/* anonymous memory is never shared */
+		return as_mmap(as, length, prot, NULL, 0, 0, false, retval);
+	}
+
+	if (offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	shared = (prot & MAP_PRIVATE) == 0;
+
+	err = filetable_get(curproc->p_filetable, fd, &file);
+	if (err) {
+		return err;
+	}
+
+	/* of_accmode should have only the O_ACCMODE bits in it */
+	KASSERT((file->of_accmode & O_ACCMODE) == file->of_accmode);
+
+	/* pages are read in, and shared ones written back, on our behalf */
+	if (file->of_accmode == O_WRONLY ||
+	    (shared && (prot & PROT_WRITE) && file->of_accmode != O_RDWR)) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return EACCES;
+	}
+
+	err = VOP_MMAP(file->of_vnode);
+	if (err == 0) {
+		err = VOP_STAT(file->of_vnode, &st);
+	}
+	if (err == 0) {
+		filesize = 0;
+		if (st.st_size > offset) {
+			filesize = st.st_size - offset < (off_t)length ?
+				(size_t)(st.st_size - offset) : length;
+		}
+		err = as_mmap(as, length, prot, file->of_vnode, offset,
+			      filesize, shared, retval);
+	}
+
+	filetable_put(curproc->p_filetable, fd, file);
+	return err;
+}
+
+/*
+ * sys_munmap
+ * Remove the mapping that starts at ADDR; see as_munmap.
+ */
+int
+sys_munmap(vaddr_t addr)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	return as_munmap(as, addr);
+}
+
+/*
+ * sys_mprotect
+ * Change the permissions of whole pages; see as_mprotect.
+ */
+int
+sys_mprotect(vaddr_t addr, size_t len, int prot)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_mprotect(as, addr, len, prot);
+}
+
+/*
+ * sys_madvise
+ * Pass on advice about how a range will be used; see as_madvise.
+ */
+int
+sys_madvise(vaddr_t addr, size_t len, int advice)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_madvise(as, addr, len, advice);
+}
+
+/*
+ * sys_shmget
+ * Find the shared memory segment named KEY, or make one of SIZE bytes
+ * if FLAGS has IPC_CREAT (always, for IPC_PRIVATE), and return its id.
+ */
+int
+sys_shmget(int key, size_t size, int flags, int *retval)
+{
+	if (flags & ~(IPC_CREAT | IPC_EXCL)) {
+		return EINVAL;
+	}
+	return shm_get(key, size, flags, retval);
+}
+
+/*
+ * sys_shmat
+ * Map all of segment SHMID with permissions PROT and return where.
+ * Every process attached to it sees the same frames.
+ */
+int
+sys_shmat(int shmid, int prot, vaddr_t *retval)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		return EINVAL;
+	}
+	return as_shmat(as, shmid, prot, retval);
+}
+
+/*
+ * sys_shmdt
+ * Undo shmat; ADDR must be what it returned.
+ */
+int
+sys_shmdt(vaddr_t addr)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_shmdt(as, addr);
+}
+
+/*
+ * sys_shmctl
+ * Only IPC_RMID: the segment can't be found again, and goes away once
+ * the last process has detached it.
+ */
+int
+sys_shmctl(int shmid, int cmd)
+{
+	if (cmd != IPC_RMID) {
+		return EINVAL;
+	}
+	return shm_remove(shmid);
+}
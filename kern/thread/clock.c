@@ -50,7 +50,7 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	64	/* Priority boost every 64 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
@@ -59,6 +59,29 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * The timing wheel. A timer due at hardclock N is filed in slot
+ * N % TIMER_SLOTS, so each hardclock only looks at one slot, which
+ * holds about 1/TIMER_SLOTS of the pending timers: the cost of a tick
+ * is the timers that fire plus a share of the rest, not all of them.
+ * Timers more than TIMER_SLOTS ticks out just stay put for another
+ * lap. timer_now counts CPU 0's hardclocks.
+ */
+#define TIMER_SLOTS		256	/* must be a power of 2 */
+#define TIMER_MAXTICKS		0x40000000	/* refiled when due */
+#define NSEC_PER_TICK		(1000000000 / HZ)
+
+static struct timer *timer_wheel[TIMER_SLOTS];
+static unsigned timer_now;
+static struct spinlock timer_lock;
+
+/*
+ * clocknanosleep's sleepers all share one channel; each is woken
+ * individually, so they don't have to be looked through.
+ */
+static struct wchan *sleep_wchan;
+static struct spinlock sleep_lock;
+
 /*
  * Setup.
  */
@@ -70,6 +93,174 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	spinlock_init(&timer_lock);
+	spinlock_init(&sleep_lock);
+	sleep_wchan = wchan_create("nanosleep");
+	if (sleep_wchan == NULL) {
+		panic("Couldn't create nanosleep wchan\n");
+	}
+}
+
+/*
+ * Put TM in the wheel for the first hardclock at or after its
+ * deadline, given that it is NOW. Call with the timer lock held.
+ */
+static
+void
+timer_file(struct timer *tm, const struct timespec *now)
+{
+	struct timespec left;
+	struct timer **slot;
+	unsigned ticks;
+
+	if (tm->tm_deadline.tv_sec < now->tv_sec ||
+	    (tm->tm_deadline.tv_sec == now->tv_sec &&
+	     tm->tm_deadline.tv_nsec <= now->tv_nsec)) {
+		ticks = 1;
+	}
+	else {
+		timespec_sub(&tm->tm_deadline, now, &left);
+		if (left.tv_sec >= TIMER_MAXTICKS / HZ) {
+			ticks = TIMER_MAXTICKS;
+		}
+		else {
+			ticks = left.tv_sec * HZ +
+				DIVROUNDUP(left.tv_nsec, NSEC_PER_TICK);
+		}
+	}
+
+	tm->tm_expires = timer_now + ticks;
+	slot = &timer_wheel[tm->tm_expires & (TIMER_SLOTS - 1)];
+	tm->tm_next = *slot;
+	tm->tm_prev = slot;
+	if (*slot != NULL) {
+		(*slot)->tm_prev = &tm->tm_next;
+	}
+	*slot = tm;
+}
+
+static
+void
+timer_unlink(struct timer *tm)
+{
+	*tm->tm_prev = tm->tm_next;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prev = tm->tm_prev;
+	}
+}
+
+void
+timer_init(struct timer *tm, void (*func)(void *), void *data)
+{
+	tm->tm_next = NULL;
+	tm->tm_prev = NULL;
+	tm->tm_pending = false;
+	tm->tm_func = func;
+	tm->tm_data = data;
+}
+
+void
+timer_start(struct timer *tm, const struct timespec *timeout)
+{
+	struct timespec now;
+
+	KASSERT(!tm->tm_pending);
+
+	gettime(&now);
+	timespec_add(&now, timeout, &tm->tm_deadline);
+
+	spinlock_acquire(&timer_lock);
+	timer_file(tm, &now);
+	tm->tm_pending = true;
+	spinlock_release(&timer_lock);
+}
+
+bool
+timer_stop(struct timer *tm)
+{
+	bool pending;
+
+	spinlock_acquire(&timer_lock);
+	pending = tm->tm_pending;
+	if (pending) {
+		timer_unlink(tm);
+		tm->tm_pending = false;
+	}
+	spinlock_release(&timer_lock);
+	return pending;
+}
+
+/*
+ * Turn the wheel one slot. Hardclocks and the time of day don't keep
+ * perfect step, so a timer whose hardclock has come but whose
+ * deadline hasn't is filed again for the rest.
+ */
+static
+void
+timer_tick(void)
+{
+	struct timer *tm, *next;
+	struct timespec now;
+	bool havetime = false;
+
+	spinlock_acquire(&timer_lock);
+	timer_now++;
+	tm = timer_wheel[timer_now & (TIMER_SLOTS - 1)];
+	for (; tm != NULL; tm = next) {
+		next = tm->tm_next;
+		if (tm->tm_expires != timer_now) {
+			/* a later lap */
+			continue;
+		}
+		if (!havetime) {
+			gettime(&now);
+			havetime = true;
+		}
+		timer_unlink(tm);
+		if (tm->tm_deadline.tv_sec > now.tv_sec ||
+		    (tm->tm_deadline.tv_sec == now.tv_sec &&
+		     tm->tm_deadline.tv_nsec > now.tv_nsec)) {
+			timer_file(tm, &now);
+			continue;
+		}
+		tm->tm_pending = false;
+		tm->tm_func(tm->tm_data);
+	}
+	spinlock_release(&timer_lock);
+}
+
+static
+void
+timedwait_expire(void *data)
+{
+	struct timedwait *tw = data;
+
+	spinlock_acquire(tw->tw_lock);
+	tw->tw_expired = true;
+	/* if something else woke it first, that wakeup stands */
+	if (wchan_wakethread(tw->tw_wchan, tw->tw_lock, tw->tw_thread)) {
+		tw->tw_fired = true;
+	}
+	spinlock_release(tw->tw_lock);
+}
+
+void
+timedwait_start(struct timedwait *tw, struct wchan *wc,
+		struct spinlock *lk, const struct timespec *timeout)
+{
+	tw->tw_thread = curthread;
+	tw->tw_wchan = wc;
+	tw->tw_lock = lk;
+	tw->tw_expired = false;
+	tw->tw_fired = false;
+	timer_init(&tw->tw_timer, timedwait_expire, tw);
+	timer_start(&tw->tw_timer, timeout);
+}
+
+void
+timedwait_stop(struct timedwait *tw)
+{
+	timer_stop(&tw->tw_timer);
 }
 
 /*
@@ -97,13 +288,18 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	if (curcpu->c_number == 0) {
+		timer_tick();
+	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	if (thread_tick()) {
+		thread_yield();
+	}
 }
 
 /*
@@ -119,3 +315,20 @@ clocksleep(int num_secs)
 	}
 	spinlock_release(&lbolt_lock);
 }
+
+/*
+ * Suspend execution for at least DURATION.
+ */
+void
+clocknanosleep(const struct timespec *duration)
+{
+	struct timedwait tw;
+
+	timedwait_start(&tw, sleep_wchan, &sleep_lock, duration);
+	spinlock_acquire(&sleep_lock);
+	while (!tw.tw_expired) {
+		wchan_sleep(sleep_wchan, &sleep_lock);
+	}
+	spinlock_release(&sleep_lock);
+	timedwait_stop(&tw);
+}
@@ -33,7 +33,9 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
@@ -120,6 +122,34 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+/*
+ * The timer has to be armed before taking the semaphore's spinlock
+ * and disarmed after dropping it; see <clock.h>.
+ */
+int
+P_timeout(struct semaphore *sem, const struct timespec *timeout)
+{
+	struct timedwait tw;
+	bool got;
+
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	timedwait_start(&tw, sem->sem_wchan, &sem->sem_lock, timeout);
+	spinlock_acquire(&sem->sem_lock);
+	while (sem->sem_count == 0 && !tw.tw_expired) {
+		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+	}
+	got = sem->sem_count > 0;
+	if (got) {
+		sem->sem_count--;
+	}
+	spinlock_release(&sem->sem_lock);
+	timedwait_stop(&tw);
+
+	return got ? 0 : ETIMEDOUT;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -222,6 +252,24 @@ lock_release(struct lock *lock)
 	spinlock_release(&lock->lk_lock);
 }
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+	bool ret;
+
+	DEBUGASSERT(lock != NULL);
+
+	spinlock_acquire(&lock->lk_lock);
+	ret = (lock->lk_holder == NULL);
+	if (ret) {
+		lock->lk_holder = curthread;
+		HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	}
+	spinlock_release(&lock->lk_lock);
+
+	return ret;
+}
+
 bool
 lock_do_i_hold(struct lock *lock)
 {
@@ -298,6 +346,33 @@ cv_wait(struct cv *cv, struct lock *lock)
 	lock_acquire(lock);
 }
 
+int
+cv_wait_timeout(struct cv *cv, struct lock *lock,
+		const struct timespec *timeout)
+{
+	struct timedwait tw;
+	bool fired;
+
+	/* as in P_timeout, arm the timer with no spinlocks held */
+	timedwait_start(&tw, cv->cv_wchan, &cv->cv_wchanlock, timeout);
+	spinlock_acquire(&cv->cv_wchanlock);
+	lock_release(lock);
+	if (tw.tw_expired) {
+		/* timed out before we even got to sleep */
+		fired = true;
+	}
+	else {
+		wchan_sleep(cv->cv_wchan, &cv->cv_wchanlock);
+		/* false if a signal woke us, even if the timer ran since */
+		fired = tw.tw_fired;
+	}
+	spinlock_release(&cv->cv_wchanlock);
+	timedwait_stop(&tw);
+	lock_acquire(lock);
+
+	return fired ? ETIMEDOUT : 0;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
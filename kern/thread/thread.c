@@ -134,6 +134,7 @@ thread_create(const char *name)
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
+	thread->t_wchan = NULL;
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
@@ -150,6 +151,13 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_nice = 0;
+	thread->t_lastcpu = NULL;
+	thread->t_lastran = 0;
+	thread->t_affinity = ~(uint32_t)0;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -182,6 +190,12 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_asid = 0;
+	c->c_asid_generation = 0;
+	bzero(&c->c_tlb, sizeof(c->c_tlb));
+	c->c_nframes = 0;
+	c->c_nzeroed = 0;
+	spinlock_init(&c->c_frames_lock);
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -445,10 +459,225 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Nice values weight the quantum like Linux's CFS does: each step is
+ * worth about 10% of the CPU against a thread one step away, so the
+ * weight goes up by 1.25 per step down. Nice 0 is 1024.
+ */
+static const unsigned nice_weight[PRIO_MAX - PRIO_MIN + 1] = {
+	/* -20 */ 88761, 71755, 56483, 46273, 36291,
+	/* -15 */ 29154, 23254, 18705, 14949, 11916,
+	/* -10 */  9548,  7620,  6100,  4904,  3906,
+	/*  -5 */  3121,  2501,  1991,  1586,  1277,
+	/*   0 */  1024,   820,   655,   526,   423,
+	/*   5 */   335,   272,   215,   172,   137,
+	/*  10 */   110,    87,    70,    56,    45,
+	/*  15 */    36,    29,    23,    18,    15,
+	/*  20 */    12,
+};
+
+/*
+ * Hardclocks a thread gets at its current level. Always at least
+ * one, so very nice threads still get to run.
+ */
+static
+unsigned
+thread_quantum(struct thread *t)
+{
+	unsigned q;
+
+	q = (MLFQ_QUANTUM << t->t_priority) * nice_weight[t->t_nice - PRIO_MIN];
+	q = (q + 512) / 1024;
+	return q > 0 ? q : 1;
+}
+
+/*
+ * The highest level a thread can reach. Positive nice values keep a
+ * thread out of the top levels, so it queues behind everything not
+ * niced even right after a boost.
+ */
+static
+unsigned
+thread_floor(struct thread *t)
+{
+	if (t->t_nice <= 0) {
+		return 0;
+	}
+	return t->t_nice * MLFQ_LEVELS / (PRIO_MAX + 1);
+}
+
+/*
+ * Put a thread on a run queue, behind everything of the same or
+ * higher priority, so the queue stays sorted by level and each level
+ * is round-robin. The queue's lock must be held.
+ */
+static
+void
+thread_enqueue(struct threadlist *rq, struct thread *t)
+{
+	struct thread *prev;
+
+	THREADLIST_FORALL_REV(prev, *rq) {
+		if (prev->t_priority <= t->t_priority) {
+			threadlist_insertafter(rq, prev, t);
+			return;
+		}
+	}
+	threadlist_addhead(rq, t);
+}
+
+/*
+ * Whether T has run on C recently enough that its cache there is
+ * probably still warm.
+ */
+static
+bool
+thread_cache_hot(struct thread *t, struct cpu *c)
+{
+	return t->t_lastcpu == c &&
+		c->c_hardclocks - t->t_lastran < CACHE_HOT_HARDCLOCKS;
+}
+
+/*
+ * Whether T's affinity mask lets it run on C.
+ */
+static
+bool
+thread_allowed(struct thread *t, struct cpu *c)
+{
+	return (t->t_affinity & ((uint32_t)1 << c->c_number)) != 0;
+}
+
+/*
+ * Wake up an idle CPU that T may run on, other than BUSY and
+ * ourselves, if there is one, so it can steal T, just queued on
+ * BUSY. c_isidle is only peeked at; a stray IPI_UNIDLE does no harm.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy, struct thread *t)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c != curcpu->c_self && c->c_isidle &&
+		    thread_allowed(t, c)) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * The least busy CPU that T may run on. The queue lengths are only
+ * peeked at; any allowed CPU will do.
+ */
+static
+struct cpu *
+thread_least_busy(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
+
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!thread_allowed(t, c)) {
+			continue;
+		}
+		if (best == NULL ||
+		    c->c_runqueue.tl_count < best->c_runqueue.tl_count) {
+			best = c;
+		}
+	}
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Steal a thread for the current CPU, which has run out of work.
+ *
+ * The victim is the busiest other CPU that isn't idle itself (an idle
+ * CPU is about to run what it has). Its queue is searched from the
+ * tail, which holds the lowest priority threads, for one allowed to
+ * run here: first one that isn't allowed to stay there, then one
+ * that isn't cache-hot, falling back to a hot one rather than leaving
+ * this CPU idle. The queue lengths are read unlocked to choose; only
+ * the victim is locked. We must not hold our own run queue lock.
+ *
+ * Returns the thread, no longer on any run queue, or NULL.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t, *pick, *cold, *hot;
+	unsigned i, numcpus, most;
+
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		if (c->c_runqueue.tl_count > most) {
+			most = c->c_runqueue.tl_count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	pick = cold = hot = NULL;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	THREADLIST_FORALL_REV(t, victim->c_runqueue) {
+		/* see thread_consider_migration about curthread */
+		if (t == victim->c_curthread ||
+		    !thread_allowed(t, curcpu->c_self)) {
+			continue;
+		}
+		if (!thread_allowed(t, victim)) {
+			pick = t;
+			break;
+		}
+		if (!thread_cache_hot(t, victim)) {
+			if (cold == NULL) {
+				cold = t;
+			}
+		}
+		else if (hot == NULL) {
+			hot = t;
+		}
+	}
+	if (pick == NULL) {
+		pick = cold != NULL ? cold : hot;
+	}
+	if (pick != NULL) {
+		threadlist_remove(&victim->c_runqueue, pick);
+		pick->t_cpu = curcpu->c_self;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      pick->t_name, victim->c_number, curcpu->c_number);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+	return pick;
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * targetcpu might be curcpu; it might not be, too. If the thread
+ * isn't allowed there any more it is sent to a CPU it may run on
+ * instead, unless targetcpu is still on its stack (idle since the
+ * thread went to sleep there). If targetcpu is busy, or the thread
+ * had to stay, an idle CPU is woken to come and steal the thread.
  */
 static
 void
@@ -465,11 +694,19 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		if (target != targetcpu->c_curthread &&
+		    !thread_allowed(target, targetcpu)) {
+			/* Off every cpu, so it can go anywhere. */
+			spinlock_release(&targetcpu->c_runqueue_lock);
+			targetcpu = thread_least_busy(target);
+			target->t_cpu = targetcpu;
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+		}
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_enqueue(&targetcpu->c_runqueue, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -478,6 +715,9 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (!targetcpu->c_isidle || !thread_allowed(target, targetcpu)) {
+		thread_kick_idle(targetcpu, target);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -522,6 +762,7 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -533,6 +774,7 @@ thread_fork(const char *name,
 		thread_destroy(newthread);
 		return result;
 	}
+	thread_setnice(newthread, proc->p_nice);
 
 	/*
 	 * Because new threads come out holding the cpu runqueue lock
@@ -564,7 +806,7 @@ static
 void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
-	struct thread *cur, *next;
+	struct thread *cur, *next, *other;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -590,8 +832,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. Not if we
+	 * may no longer run here, though: see below.
+	 */
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    thread_allowed(cur, curcpu->c_self)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -605,7 +851,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		/* Gave up the cpu before its quantum ran out: promote. */
+		if (cur->t_priority > thread_floor(cur)) {
+			cur->t_priority--;
+		}
+		cur->t_ticks = 0;
 		cur->t_wchan_name = wc->wc_name;
+		cur->t_wchan = wc;
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -639,15 +891,40 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * If the only thread to run is cur, but its affinity no longer
+	 * allows this cpu, try to steal something else to run instead.
+	 * Nothing can take cur from us while we are still on its stack;
+	 * once we have switched away it is just another misplaced thread
+	 * on our run queue, for an allowed idle cpu to steal or
+	 * thread_migrate_misplaced to send away. If there is nothing to
+	 * steal, cur carries on here.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
+		if (next == cur && !thread_allowed(cur, curcpu->c_self)) {
+			spinlock_release(&curcpu->c_runqueue_lock);
+			other = thread_steal();
+			spinlock_acquire(&curcpu->c_runqueue_lock);
+			if (other != NULL) {
+				thread_enqueue(&curcpu->c_runqueue, cur);
+				thread_kick_idle(curcpu->c_self, cur);
+				next = other;
+			}
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/*
+			 * Try to steal work from a busier CPU, then do
+			 * background VM work, if any, before sleeping.
+			 */
+			next = thread_steal();
+			if (next == NULL && !vm_idle()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -663,6 +940,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	curcpu->c_curthread = next;
 	curthread = next;
 
+	/* Remember where and when, for thread_cache_hot. */
+	cur->t_lastcpu = curcpu->c_self;
+	cur->t_lastran = curcpu->c_hardclocks;
+
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
 
@@ -821,17 +1102,125 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Run queues are multi-level feedback queues: thread_enqueue keeps
+ * them sorted by t_priority, so the head is always the best thread to
+ * run. A thread that uses its whole quantum (thread_tick) drops a
+ * level; one that blocks (thread_switch) rises one. That leaves
+ * interactive threads near the top and CPU hogs at the bottom, where
+ * they could starve, so schedule() periodically boosts everything
+ * back to the top level. Nice values (see thread_quantum and
+ * thread_floor) stretch or shrink the quantum and cap how high a
+ * thread can rise.
+ */
+
+bool
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	struct thread *next;
+	bool preempt;
+
+	if (curcpu->c_isidle) {
+		return false;
+	}
+
+	cur->t_ticks++;
+	if (cur->t_ticks >= thread_quantum(cur)) {
+		if (cur->t_priority < MLFQ_LEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+		return true;
+	}
+
+	/* Not allowed here any more: see if thread_switch can move us. */
+	if (!thread_allowed(cur, curcpu->c_self)) {
+		return true;
+	}
+
+	/* Otherwise only give way to something more important. */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	next = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+	preempt = next != NULL && next->t_priority < cur->t_priority;
+	spinlock_release(&curcpu->c_runqueue_lock);
+	return preempt;
+}
+
+/*
+ * Called from sys_setpriority and when a thread is created. Takes
+ * effect from the thread's next quantum; it doesn't move the thread
+ * if it's on a run queue.
+ */
+void
+thread_setnice(struct thread *t, int nice)
+{
+	KASSERT(nice >= PRIO_MIN && nice <= PRIO_MAX);
+
+	t->t_nice = nice;
+	if (t->t_priority < thread_floor(t)) {
+		t->t_priority = thread_floor(t);
+	}
+}
+
+/*
+ * Called from sys_sched_setaffinity and friends. A thread that is
+ * running or queued on a CPU outside MASK is moved later, by
+ * thread_consider_migration or by an idle CPU stealing it.
  */
+void
+thread_setaffinity(struct thread *t, uint32_t mask)
+{
+	KASSERT(mask != 0);
+	t->t_affinity = mask;
+}
+
+uint32_t
+thread_allcpus_mask(void)
+{
+	unsigned numcpus = cpuarray_num(&allcpus);
+
+	return numcpus >= 32 ? ~(uint32_t)0 : ((uint32_t)1 << numcpus) - 1;
+}
+
+/*
+ * Return cpu number NUM, or NULL if there is no such cpu.
+ */
+struct cpu *
+thread_getcpu(unsigned num)
+{
+	if (num >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, num);
+}
 
+/*
+ * This is called periodically from hardclock(). Boost every thread
+ * on this CPU back to the top level it is allowed. That can reorder
+ * threads with different nice values, so rebuild the queue.
+ */
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct threadlist boosted;
+	struct thread *t;
+
+	threadlist_init(&boosted);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	while ((t = threadlist_remhead(&curcpu->c_runqueue)) != NULL) {
+		t->t_priority = thread_floor(t);
+		t->t_ticks = 0;
+		thread_enqueue(&boosted, t);
+	}
+	while ((t = threadlist_remhead(&boosted)) != NULL) {
+		threadlist_addtail(&curcpu->c_runqueue, t);
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = thread_floor(curthread);
+		curthread->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	threadlist_cleanup(&boosted);
 }
 
 /*
@@ -847,10 +1236,50 @@ schedule(void)
  * and the performance loss due to underutilization of some CPUs is
  * something that needs to be tuned and probably is workload-specific.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * System/161 does not (yet) model such cache effects, but the TLB
+ * has to be refilled on the new CPU too, so we leave threads that
+ * have run here very recently (see thread_cache_hot) where they are.
+ * Threads are only ever sent to CPUs their affinity mask allows, and
+ * threads that aren't allowed here are sent away first, whether or
+ * not this CPU is busy.
  */
+
+/*
+ * Send every thread on our run queue that may not run here to the
+ * least busy CPU it may run on.
+ */
+static
+void
+thread_migrate_misplaced(void)
+{
+	struct threadlist misplaced;
+	struct thread *t, *prev;
+	struct cpu *best;
+
+	threadlist_init(&misplaced);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	t = curcpu->c_runqueue.tl_tail.tln_prev->tln_self;
+	while (t != NULL) {
+		prev = t->t_listnode.tln_prev->tln_self;
+		/* see below about curthread */
+		if (t != curthread && !thread_allowed(t, curcpu->c_self)) {
+			threadlist_remove(&curcpu->c_runqueue, t);
+			threadlist_addhead(&misplaced, t);
+		}
+		t = prev;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	while ((t = threadlist_remhead(&misplaced)) != NULL) {
+		best = thread_least_busy(t);
+		DEBUG(DB_THREADS, "Migrated thread %s: cpu %u -> %u",
+		      t->t_name, curcpu->c_number, best->c_number);
+		t->t_cpu = best;
+		thread_make_runnable(t, false);
+	}
+	threadlist_cleanup(&misplaced);
+}
+
 void
 thread_consider_migration(void)
 {
@@ -858,7 +1287,9 @@ thread_consider_migration(void)
 	unsigned i, numcpus;
 	struct cpu *c;
 	struct threadlist victims;
-	struct thread *t;
+	struct thread *t, *prev;
+
+	thread_migrate_misplaced();
 
 	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
@@ -877,13 +1308,20 @@ thread_consider_migration(void)
 		return;
 	}
 
+	/* Take the excess from the tail, skipping cache-hot threads. */
 	to_send = my_count - one_share;
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	t = curcpu->c_runqueue.tl_tail.tln_prev->tln_self;
+	while (t != NULL && victims.tl_count < to_send) {
+		prev = t->t_listnode.tln_prev->tln_self;
+		if (!thread_cache_hot(t, curcpu->c_self)) {
+			threadlist_remove(&curcpu->c_runqueue, t);
+			threadlist_addhead(&victims, t);
+		}
+		t = prev;
 	}
+	to_send = victims.tl_count;
 	spinlock_release(&curcpu->c_runqueue_lock);
 
 	for (i=0; i < numcpus && to_send > 0; i++) {
@@ -893,7 +1331,16 @@ thread_consider_migration(void)
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
 		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
+			/* the first one that may run there */
+			THREADLIST_FORALL(t, victims) {
+				if (thread_allowed(t, c)) {
+					break;
+				}
+			}
+			if (t == NULL) {
+				break;
+			}
+			threadlist_remove(&victims, t);
 			/*
 			 * Ordinarily, curthread will not appear on
 			 * the run queue. However, it can under the
@@ -923,7 +1370,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			thread_enqueue(&c->c_runqueue, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -947,7 +1394,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			thread_enqueue(&curcpu->c_runqueue, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1036,6 +1483,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 		/* Nobody was sleeping. */
 		return;
 	}
+	target->t_wchan = NULL;
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1066,6 +1514,7 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * private list.
 	 */
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
 		threadlist_addtail(&list, target);
 	}
 
@@ -1081,6 +1530,27 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Wake up one particular thread, if it's sleeping on a wait channel.
+ * t_wchan is only changed with the channel's spinlock held, so it
+ * tells us whether T is on this channel's list.
+ */
+bool
+wchan_wakethread(struct wchan *wc, struct spinlock *lk, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(lk));
+
+	if (t->t_wchan != wc) {
+		return false;
+	}
+	threadlist_remove(&wc->wc_threads, t);
+	t->t_wchan = NULL;
+
+	/* As in wchan_wakeone. */
+	thread_make_runnable(t, false);
+	return true;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1167,6 +1637,24 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+unsigned
+ipi_tlbshootdown_cpus(uint32_t cpus, const struct tlbshootdown *mapping)
+{
+	unsigned i, sent;
+	struct cpu *c;
+
+	sent = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self &&
+		    (cpus & ((uint32_t)1 << c->c_number)) != 0) {
+			ipi_tlbshootdown(c, mapping);
+			sent++;
+		}
+	}
+	return sent;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
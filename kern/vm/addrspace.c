@@ -27,8 +27,11 @@
  * SUCH DAMAGE.
  */
 
+#define ASINLINE	/* empty */
+
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -38,6 +41,9 @@
 #include <vm.h>
 #include <proc.h>
 #include <synch.h>
+#include <vnode.h>
+#include <swap.h>
+#include <shm.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -49,6 +55,11 @@
  *
  */
 
+static unsigned as_region_index(struct addrspace *as, vaddr_t vaddr);
+static int as_insert_region(struct addrspace *as, unsigned index,
+			    struct region *reg);
+static void as_free_region(struct region *reg);
+
 /*
  * allocate a data structure used to keep track of an address space
  * i.e. regions
@@ -66,32 +77,35 @@ as_create(void)
 	/*
 	 * Initialize as needed.
 	 */
-	as->region_list = NULL;
-
-	// initialize first-level page table
-	as->pagetable = (paddr_t **) alloc_kpages(1);
+	regionarray_init(&as->regions);
+	as->last_region = NULL;
+	as->heap = NULL;
+	as->heap_break = 0;
+	as->stack = NULL;
 
-	if (as->pagetable == NULL) {
+	if (pt_create(as)) {
 		kfree(as);
 		return NULL;
 	}
 
-	// set 1st lvl page table entries to NULL using index as offsets
-	for (int i = 0; i < PT_SIZE; i++) {
-		as->pagetable[i] = NULL;
-	}
 	as->pt_lock = lock_create("page_table_lock");
 
+	/* no ASID until first activated */
+	as->asid = 0;
+	as->asid_generation = 0;
+	as->asid_cpus = 0;
+
+	as->rss = 0;
+	as->oom_killed = false;
+	vm_oom_register(as);
+
 	return as;
 }
 
 /*
  * allocates a new (destination) address space
  * adds all the same regions as source
- * roughly, for each mapped page in source
- * 	allocate a frame in dest
- * 	copy contents from frame to dest frame
- * 	add PT entry for dest
+ * shares every mapped page of source with dest copy-on-write
  */
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
@@ -107,34 +121,93 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	 * Write this.
 	 */
 
-	struct region *curr = old->region_list;
-	while (curr != NULL) {
+	for (unsigned i = 0; i < regionarray_num(&old->regions); i++) {
+		struct region *curr = regionarray_get(&old->regions, i);
 		int result = as_define_region(newas, curr->vaddr, curr->memsize, curr->readable, curr->writeable, curr->executable);
 		if (result) {
 			as_destroy(newas);
 			return result;
 		}
-		curr = curr->next;
+		// copied in order, so the new region is the last one
+		struct region *copy = regionarray_get(&newas->regions, i);
+		if (curr == old->heap) {
+			newas->heap = copy;
+			newas->heap_break = old->heap_break;
+		}
+		if (curr == old->stack) {
+			newas->stack = copy;
+		}
+		if (curr->vnode != NULL) {
+			VOP_INCREF(curr->vnode);
+			copy->vnode = curr->vnode;
+		}
+		copy->file_offset = curr->file_offset;
+		copy->file_vaddr = curr->file_vaddr;
+		copy->filesize = curr->filesize;
+		copy->mmapped = curr->mmapped;
+		copy->shared = curr->shared;
+		copy->advice = curr->advice;
+		if (curr->shm != NULL) {
+			shm_incref(curr->shm);
+			copy->shm = curr->shm;
+		}
 	}
 
 	/*
-	 * roughly, for each mapped page in source
-	 *  allocate a frame in dest
-	 *  copy contents from frame to dest frame
-	 *  add PT entry for dest
+	 * Rather than copying, both address spaces point at the same
+	 * frames read-only; vm_fault copies a page on the first write.
+	 * That clears the dirty bits shared mappings use to find what to
+	 * write back, so flush those to their files first. Their pages
+	 * must also all be resident, or each side would later read its
+	 * own copy of a page in from the file and stop seeing the
+	 * other's writes.
 	 */
-	curr = old->region_list;
 	lock_acquire(old->pt_lock);
-	//lock_acquire(newas->pt_lock);
-	vm_copy_pt(old->pagetable, newas->pagetable);
-	//lock_release(newas->pt_lock);
+	/* the OOM killer may look at newas as soon as it exists */
+	lock_acquire(newas->pt_lock);
+	int result = 0;
+	for (unsigned i = 0; i < regionarray_num(&old->regions); i++) {
+		struct region *curr = regionarray_get(&old->regions, i);
+		if (curr->shared) {
+			result = vm_writeback(old, curr);
+			for (vaddr_t va = curr->vaddr;
+			     result == 0 && va < curr->vaddr + curr->memsize;
+			     va += PAGE_SIZE) {
+				result = vm_prefault(old, curr, va);
+			}
+			if (result) {
+				break;
+			}
+		}
+	}
+	if (result == 0) {
+		result = pt_copy(old, newas);
+	}
+	if (result == 0) {
+		/* the same pages are resident in both now */
+		newas->rss = old->rss;
+	}
+	lock_release(newas->pt_lock);
 	lock_release(old->pt_lock);
+
+	/*
+	 * old's TLB entries, here and on any other cpu it has run on,
+	 * may still allow writes to the shared frames.
+	 */
+	vm_asid_retire(old);
+	as_activate();
+
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
+
 	*ret = newas;
 	return 0;
 }
 
 /* 
- * deallocate book keeping (region linked list) and page tables
+ * deallocate book keeping (region array) and the page table;
  * deallocate frames used
  */
 void
@@ -143,37 +216,33 @@ as_destroy(struct addrspace *as)
 	/*
 	 * Clean up as needed.
 	 */
+	vm_oom_unregister(as);
 	lock_acquire(as->pt_lock);
-	for (int i = 0; i < PT_SIZE; i++) {
-		if (as->pagetable[i] != NULL) {
-			for (int j = 0; j < PT_SIZE; j++) {
-				if (as->pagetable[i][j] != 0) {
-					free_kpages(PADDR_TO_KVADDR(as->pagetable[i][j]) & PAGE_FRAME);
-				}
-			}
+	for (unsigned i = 0; i < regionarray_num(&as->regions); i++) {
+		struct region *curr = regionarray_get(&as->regions, i);
+		if (curr->shared) {
+			/* nobody to report an error to any more */
+			(void)vm_writeback(as, curr);
 		}
 	}
-	kfree(as->pagetable);
+	pt_destroy(as);
 
-	struct region *tmp;
-	struct region *curr = as->region_list;
-	while (curr != NULL) {
-		tmp = curr;
-		curr = curr->next;
-		kfree(tmp);
+	for (unsigned i = 0; i < regionarray_num(&as->regions); i++) {
+		as_free_region(regionarray_get(&as->regions, i));
 	}
+	regionarray_setsize(&as->regions, 0);
+	regionarray_cleanup(&as->regions);
 	lock_release(as->pt_lock);
 	lock_destroy(as->pt_lock);
 	kfree(as);
 }
 
 /*
- * flush TLB
+ * switch the TLB over to curproc's ASID; nothing is flushed
  */
 void
 as_activate(void)
 {
-	int i, spl;
 	struct addrspace *as;
 
 	as = proc_getas();
@@ -185,31 +254,17 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
-	/* Disable interrupts on this CPU while frobbing the tlb. */
-	spl = splhigh();
-
-	for (i = 0; i < NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
-
-	splx(spl);
+	vm_asid_activate(as);
 }
 
 /*
- * flush TLB
+ * nothing to do: entries tagged with the old ASID can't be matched
+ * once another one is loaded, and the ASID isn't reused until the
+ * next generation flush
  */
 void
 as_deactivate(void)
 {
-	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
-	 */
-	as_activate();
 }
 
 /*
@@ -239,14 +294,20 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		return EFAULT;
 	}
 
-	// Check for overlapping regions
-	struct region *curr = as->region_list;
-	while (curr != NULL) {
-		if ((vaddr <= curr->vaddr + curr->memsize) &&
-			(vaddr + memsize) >= curr->vaddr) {
+	// Check for overlapping regions: only the neighbours in sorted
+	// order can overlap
+	unsigned index = as_region_index(as, vaddr);
+	if (index > 0) {
+		struct region *prev = regionarray_get(&as->regions, index - 1);
+		if (prev->vaddr + prev->memsize > vaddr) {
+			return EINVAL;
+		}
+	}
+	if (index < regionarray_num(&as->regions)) {
+		struct region *next = regionarray_get(&as->regions, index);
+		if (vaddr + memsize > next->vaddr) {
 			return EINVAL;
 		}
-		curr = curr->next;
 	}
 
 	struct region *new_region = kmalloc(sizeof(struct region));
@@ -260,10 +321,131 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	new_region->writeable = writeable;
 	new_region->executable = executable;
 	new_region->old_writeable = writeable;
-	new_region->next = NULL;
+	new_region->vnode = NULL;
+	new_region->file_offset = 0;
+	new_region->file_vaddr = 0;
+	new_region->filesize = 0;
+	new_region->mmapped = false;
+	new_region->shared = false;
+	new_region->advice = MADV_NORMAL;
+	new_region->shm = NULL;
+
+	int result = as_insert_region(as, index, new_region);
+	if (result) {
+		kfree(new_region);
+		return result;
+	}
+
+	return 0;
+}
+
+/*
+ * open a gap at index and put reg there
+ */
+static
+int
+as_insert_region(struct addrspace *as, unsigned index, struct region *reg)
+{
+	unsigned num = regionarray_num(&as->regions);
+	int result = regionarray_setsize(&as->regions, num + 1);
+	if (result) {
+		return result;
+	}
+	for (unsigned i = num; i > index; i--) {
+		regionarray_set(&as->regions, i,
+				regionarray_get(&as->regions, i - 1));
+	}
+	regionarray_set(&as->regions, index, reg);
+	return 0;
+}
+
+/*
+ * drop what a region holds on to, once it is out of the array
+ */
+static
+void
+as_free_region(struct region *reg)
+{
+	if (reg->vnode != NULL) {
+		VOP_DECREF(reg->vnode);
+	}
+	if (reg->shm != NULL) {
+		shm_detach(reg->shm);
+	}
+	kfree(reg);
+}
+
+/*
+ * index of the first region that ends above vaddr, i.e. the one that
+ * contains vaddr if any does, else where a region at vaddr would go
+ */
+static
+unsigned
+as_region_index(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned lo = 0, hi = regionarray_num(&as->regions);
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		struct region *reg = regionarray_get(&as->regions, mid);
+		if (reg->vaddr + reg->memsize <= vaddr) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * find the region containing vaddr; faults tend to hit the same region
+ * over and over, so try the last one found first
+ */
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *reg = as->last_region;
+
+	if (reg != NULL && vaddr >= reg->vaddr &&
+	    vaddr < reg->vaddr + reg->memsize) {
+		return reg;
+	}
+
+	unsigned index = as_region_index(as, vaddr);
+	if (index == regionarray_num(&as->regions)) {
+		return NULL;
+	}
+	reg = regionarray_get(&as->regions, index);
+	if (vaddr < reg->vaddr) {
+		return NULL;
+	}
+	as->last_region = reg;
+	return reg;
+}
+
+/*
+ * record that FILESIZE bytes at VADDR come from V at OFFSET; the pages
+ * are read in by vm_fault on first touch instead of at exec time
+ */
+int
+as_define_backing(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+		  off_t offset, size_t filesize)
+{
+	struct region *curr = as_find_region(as, vaddr);
+
+	if (curr == NULL || vaddr + filesize > curr->vaddr + curr->memsize) {
+		return EFAULT;
+	}
+	if (curr->vnode != NULL) {
+		VOP_DECREF(curr->vnode);
+	}
 
-	new_region->next = as->region_list;
-	as->region_list = new_region;
+	VOP_INCREF(v);
+	curr->vnode = v;
+	curr->file_offset = offset;
+	curr->file_vaddr = vaddr;
+	curr->filesize = filesize;
 
 	return 0;
 }
@@ -278,11 +460,10 @@ as_prepare_load(struct addrspace *as)
 	 * Write this.
 	 */
 
-	struct region *curr = as->region_list;
-	while (curr != NULL) {
+	for (unsigned i = 0; i < regionarray_num(&as->regions); i++) {
+		struct region *curr = regionarray_get(&as->regions, i);
 		curr->old_writeable = curr->writeable;
 		curr->writeable = true;
-		curr = curr->next;
 	}
 
 	return 0;
@@ -297,13 +478,27 @@ as_complete_load(struct addrspace *as)
 	/*
 	 * Write this.
 	 */
+	vm_asid_retire(as);
 	as_activate();
-	struct region *curr = as->region_list;
-	while (curr != NULL) {
+	for (unsigned i = 0; i < regionarray_num(&as->regions); i++) {
+		struct region *curr = regionarray_get(&as->regions, i);
 		curr->writeable = curr->old_writeable;
-		curr = curr->next;
 	}
 
+	/* the heap starts out empty just above the highest segment */
+	vaddr_t heap_start = 0;
+	unsigned num = regionarray_num(&as->regions);
+	if (num > 0) {
+		struct region *top = regionarray_get(&as->regions, num - 1);
+		heap_start = top->vaddr + top->memsize;
+	}
+	int result = as_define_region(as, heap_start, 0, true, true, false);
+	if (result) {
+		return result;
+	}
+	as->heap = regionarray_get(&as->regions, num);
+	as->heap_break = heap_start;
+
 	return 0;
 }
 
@@ -313,10 +508,623 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	/*
 	 * Write this.
 	 */
+	int result;
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
 
-	return as_define_region(as, *stackptr - PAGE_SIZE * NUM_STACK_PAGES, PAGE_SIZE * NUM_STACK_PAGES, true, true, false);
+	result = as_define_region(as, USERSTACK - PAGE_SIZE * STACK_INITIAL_PAGES,
+				  PAGE_SIZE * STACK_INITIAL_PAGES,
+				  true, true, false);
+	if (result) {
+		return result;
+	}
+	as->stack = as_find_region(as, USERSTACK - PAGE_SIZE);
+	return 0;
+}
+
+/*
+ * the lowest address reg may come to occupy: the stack has the space
+ * it is allowed to grow into reserved below it, plus the guard gap
+ */
+static
+vaddr_t
+as_region_floor(struct addrspace *as, struct region *reg)
+{
+	if (reg == as->stack) {
+		return STACK_LOWEST - STACK_GUARD_PAGES * PAGE_SIZE;
+	}
+	return reg->vaddr;
+}
+
+struct region *
+as_grow_stack(struct addrspace *as, vaddr_t vaddr, size_t limit)
+{
+	struct region *stack = as->stack;
+	unsigned index;
+
+	KASSERT(lock_do_i_hold(as->pt_lock));
+
+	vaddr &= PAGE_FRAME;
+	if (stack == NULL || vaddr >= stack->vaddr ||
+	    vaddr < STACK_LOWEST || USERSTACK - vaddr > limit) {
+		return NULL;
+	}
+
+	/* nothing may sit between, and the guard gap must stay clear */
+	index = as_region_index(as, vaddr);
+	if (regionarray_get(&as->regions, index) != stack) {
+		return NULL;
+	}
+	if (index > 0) {
+		struct region *below = regionarray_get(&as->regions, index - 1);
+		if (below->vaddr + below->memsize +
+		    STACK_GUARD_PAGES * PAGE_SIZE > vaddr) {
+			return NULL;
+		}
+	}
+
+	stack->memsize += stack->vaddr - vaddr;
+	stack->vaddr = vaddr;
+	return stack;
+}
+
+/*
+ * move the break; the heap region always covers it, rounded up to a
+ * whole page, and may grow until it would run into the next region
+ */
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *heap = as->heap;
+	vaddr_t newbreak, oldend, newend, limit;
+
+	if (heap == NULL) {
+		return ENOMEM;
+	}
+
+	lock_acquire(as->pt_lock);
+
+	*oldbreak = as->heap_break;
+	newbreak = as->heap_break + amount;
+	if (amount < 0 && newbreak < heap->vaddr) {
+		lock_release(as->pt_lock);
+		return EINVAL;
+	}
+	if (amount > 0 && newbreak < as->heap_break) {
+		/* wrapped around */
+		lock_release(as->pt_lock);
+		return ENOMEM;
+	}
+
+	oldend = heap->vaddr + heap->memsize;
+	newend = ROUNDUP(newbreak, PAGE_SIZE);
+
+	limit = MIPS_KSEG0;
+	unsigned index = as_region_index(as, oldend);
+	if (index < regionarray_num(&as->regions)) {
+		limit = as_region_floor(as,
+				regionarray_get(&as->regions, index));
+	}
+	if (newend > limit || newend < newbreak) {
+		lock_release(as->pt_lock);
+		return ENOMEM;
+	}
+
+	if (newend < oldend) {
+		/* hand the memory back now, not at exit */
+		vm_unmap_range(as, newend, oldend);
+	}
+	heap->memsize = newend - heap->vaddr;
+	as->heap_break = newbreak;
+
+	lock_release(as->pt_lock);
+	return 0;
+}
+
+/*
+ * find room for LENGTH bytes (a whole number of pages) somewhere
+ * between the heap and the stack; the highest gap that is big enough
+ * is used, so the heap keeps as much room to grow as possible.
+ * Returns 0 if there is none.
+ */
+static
+vaddr_t
+as_find_gap(struct addrspace *as, size_t length)
+{
+	vaddr_t floor, top, bottom;
+	struct region *reg;
+	unsigned i;
+
+	floor = 0;
+	if (as->heap != NULL) {
+		floor = as->heap->vaddr + as->heap->memsize;
+	}
+
+	/*
+	 * look at the gaps below each region, from the top down, leaving
+	 * room for the stack to grow
+	 */
+	top = MIPS_KSEG0;
+	for (i = regionarray_num(&as->regions); i > 0; i--) {
+		reg = regionarray_get(&as->regions, i - 1);
+		bottom = reg->vaddr + reg->memsize;
+		if (bottom < floor) {
+			break;
+		}
+		if (top > bottom && top - bottom >= length) {
+			return top - length;
+		}
+		top = as_region_floor(as, reg);
+	}
+	return 0;
+}
+
+/*
+ * make a mappable region of LENGTH bytes at a free spot and hand it
+ * back; the caller holds the page table lock
+ */
+static
+int
+as_map_region(struct addrspace *as, size_t length, int prot,
+	      struct region **ret)
+{
+	vaddr_t vaddr;
+	int result;
+
+	vaddr = as_find_gap(as, length);
+	if (vaddr == 0) {
+		return ENOMEM;
+	}
+
+	result = as_define_region(as, vaddr, length, (prot & PROT_READ) != 0,
+				  (prot & PROT_WRITE) != 0,
+				  (prot & PROT_EXEC) != 0);
+	if (result) {
+		return result;
+	}
+
+	*ret = regionarray_get(&as->regions, as_region_index(as, vaddr));
+	(*ret)->mmapped = true;
+	/* file_vaddr also marks which mapping a piece of one belongs to */
+	(*ret)->file_vaddr = vaddr;
+	return 0;
+}
+
+/*
+ * map LENGTH bytes between the heap and the stack. FILESIZE bytes
+ * from OFFSET in V back the start of the region, the rest (or all of
+ * it if V is NULL) is zero. A SHARED mapping stays shared with the
+ * children of a fork (as_copy brings its pages in first so they do);
+ * the zero part past the file is private to each process, as nothing
+ * writes it back.
+ */
+int
+as_mmap(struct addrspace *as, size_t length, int prot, struct vnode *v,
+	off_t offset, size_t filesize, bool shared, vaddr_t *ret)
+{
+	struct region *reg;
+	int result;
+
+	KASSERT(filesize <= length);
+	KASSERT(v != NULL || !shared);
+
+	length = ROUNDUP(length, PAGE_SIZE);
+	if (length == 0) {
+		/* wrapped around */
+		return ENOMEM;
+	}
+
+	lock_acquire(as->pt_lock);
+
+	result = as_map_region(as, length, prot, &reg);
+	if (result) {
+		lock_release(as->pt_lock);
+		return result;
+	}
+
+	reg->shared = shared;
+	if (v != NULL) {
+		VOP_INCREF(v);
+		reg->vnode = v;
+		reg->file_offset = offset;
+		reg->filesize = filesize;
+	}
+
+	lock_release(as->pt_lock);
+	*ret = reg->vaddr;
+	return 0;
+}
+
+/*
+ * remove every piece of the mapping that starts at VADDR, which is
+ * regions[index]. mprotect and madvise may have split it up, but
+ * every piece still has its file_vaddr pointing at the start.
+ */
+static
+int
+as_unmap_pieces(struct addrspace *as, unsigned index, vaddr_t vaddr)
+{
+	struct region *reg;
+	int result;
+
+	while (index < regionarray_num(&as->regions)) {
+		reg = regionarray_get(&as->regions, index);
+		if (!reg->mmapped || reg->file_vaddr != vaddr) {
+			break;
+		}
+
+		if (reg->shared) {
+			result = vm_writeback(as, reg);
+			if (result) {
+				return result;
+			}
+		}
+		vm_unmap_range(as, reg->vaddr, reg->vaddr + reg->memsize);
+
+		regionarray_remove(&as->regions, index);
+		if (as->last_region == reg) {
+			as->last_region = NULL;
+		}
+		as_free_region(reg);
+	}
+	return 0;
+}
+
+/*
+ * the start of the mapping at VADDR: its index, or the number of
+ * regions if there is no mapping (of the right kind) there
+ */
+static
+unsigned
+as_mapping_index(struct addrspace *as, vaddr_t vaddr, bool shm)
+{
+	struct region *reg;
+	unsigned index;
+
+	index = as_region_index(as, vaddr);
+	if (index < regionarray_num(&as->regions)) {
+		reg = regionarray_get(&as->regions, index);
+		if (reg->vaddr == vaddr && reg->mmapped &&
+		    reg->file_vaddr == vaddr && (reg->shm != NULL) == shm) {
+			return index;
+		}
+	}
+	return regionarray_num(&as->regions);
+}
+
+/*
+ * undo as_mmap; VADDR must be the start of the mapping
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned index;
+	int result;
+
+	lock_acquire(as->pt_lock);
+
+	index = as_mapping_index(as, vaddr, false);
+	if (index == regionarray_num(&as->regions)) {
+		lock_release(as->pt_lock);
+		return EINVAL;
+	}
+	result = as_unmap_pieces(as, index, vaddr);
+
+	lock_release(as->pt_lock);
+	return result;
+}
+
+/*
+ * map all of shared memory segment ID between the heap and the stack
+ */
+int
+as_shmat(struct addrspace *as, int id, int prot, vaddr_t *ret)
+{
+	struct shmseg *seg;
+	struct region *reg;
+	size_t size;
+	int result;
+
+	result = shm_attach(id, &seg, &size);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(as->pt_lock);
+	result = as_map_region(as, size, prot, &reg);
+	if (result) {
+		lock_release(as->pt_lock);
+		shm_detach(seg);
+		return result;
+	}
+	reg->shm = seg;
+	lock_release(as->pt_lock);
+
+	*ret = reg->vaddr;
+	return 0;
+}
+
+/*
+ * undo as_shmat; VADDR must be where the segment was attached
+ */
+int
+as_shmdt(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned index;
+	int result;
+
+	lock_acquire(as->pt_lock);
+
+	index = as_mapping_index(as, vaddr, true);
+	if (index == regionarray_num(&as->regions)) {
+		lock_release(as->pt_lock);
+		return EINVAL;
+	}
+	result = as_unmap_pieces(as, index, vaddr);
+
+	lock_release(as->pt_lock);
+	return result;
+}
+
+/*
+ * push the changes made through shared mappings of V out to the file
+ */
+int
+as_sync(struct addrspace *as, struct vnode *v)
+{
+	int result = 0;
+
+	lock_acquire(as->pt_lock);
+	for (unsigned i = 0; i < regionarray_num(&as->regions); i++) {
+		struct region *curr = regionarray_get(&as->regions, i);
+		if (curr->shared && curr->vnode == v) {
+			result = vm_writeback(as, curr);
+			if (result) {
+				break;
+			}
+		}
+	}
+	lock_release(as->pt_lock);
+	return result;
+}
+
+/*
+ * cut the region containing VADDR in two at VADDR, unless VADDR is at
+ * its start already (or not in a region at all). The heap has to stay
+ * in one piece for sbrk.
+ */
+static
+int
+as_split_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *reg, *upper;
+	unsigned index;
+	int result;
+
+	index = as_region_index(as, vaddr);
+	if (index == regionarray_num(&as->regions)) {
+		return 0;
+	}
+	reg = regionarray_get(&as->regions, index);
+	if (vaddr <= reg->vaddr) {
+		return 0;
+	}
+	if (reg == as->heap) {
+		return EINVAL;
+	}
+
+	upper = kmalloc(sizeof(struct region));
+	if (upper == NULL) {
+		return ENOMEM;
+	}
+	/* both halves keep the file fields; vm_fault clips by address */
+	*upper = *reg;
+	upper->vaddr = vaddr;
+	upper->memsize = reg->vaddr + reg->memsize - vaddr;
+
+	result = as_insert_region(as, index + 1, upper);
+	if (result) {
+		kfree(upper);
+		return result;
+	}
+	if (upper->vnode != NULL) {
+		VOP_INCREF(upper->vnode);
+	}
+	if (upper->shm != NULL) {
+		shm_incref(upper->shm);
+	}
+	reg->memsize = vaddr - reg->vaddr;
+	return 0;
+}
+
+/*
+ * is all of [start, end) inside regions?
+ */
+static
+bool
+as_range_mapped(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	vaddr_t va = start;
+
+	for (unsigned i = as_region_index(as, start); va < end; i++) {
+		if (i == regionarray_num(&as->regions)) {
+			return false;
+		}
+		struct region *reg = regionarray_get(&as->regions, i);
+		if (reg->vaddr > va) {
+			return false;
+		}
+		va = reg->vaddr + reg->memsize;
+	}
+	return true;
+}
+
+/*
+ * check that all of [start, end) is mapped, and split the regions at
+ * either end so that it is made up of whole regions
+ */
+static
+int
+as_split_range(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	int result;
+
+	if (!as_range_mapped(as, start, end)) {
+		return ENOMEM;
+	}
+	result = as_split_region(as, start);
+	if (result) {
+		return result;
+	}
+	return as_split_region(as, end);
+}
+
+/*
+ * page align a range from userland; fails if it wraps around
+ */
+static
+int
+as_user_range(vaddr_t vaddr, size_t len, vaddr_t *end)
+{
+	if (vaddr & ~(vaddr_t)PAGE_FRAME) {
+		return EINVAL;
+	}
+	*end = ROUNDUP(vaddr + len, PAGE_SIZE);
+	if (*end < vaddr || (len > 0 && *end == vaddr)) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * change the permissions of a range. Taking away write access (or all
+ * access) drops the cached translations so vm_fault gets to check the
+ * next use; shared pages are written back first because the dirty bit
+ * is how we know they were changed. Giving access needs nothing done:
+ * the pages fault and are checked against the new permissions.
+ */
+int
+as_mprotect(struct addrspace *as, vaddr_t vaddr, size_t len, int prot)
+{
+	vaddr_t end;
+	int result;
+
+	if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		return EINVAL;
+	}
+	result = as_user_range(vaddr, len, &end);
+	if (result || len == 0) {
+		return result;
+	}
+
+	lock_acquire(as->pt_lock);
+
+	result = as_split_range(as, vaddr, end);
+	for (unsigned i = as_region_index(as, vaddr);
+	     result == 0 && i < regionarray_num(&as->regions); i++) {
+		struct region *reg = regionarray_get(&as->regions, i);
+		if (reg->vaddr >= end) {
+			break;
+		}
+
+		bool revoke = (reg->writeable && !(prot & PROT_WRITE)) ||
+			(prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) == 0;
+		if (revoke && reg->shared && reg->writeable) {
+			result = vm_writeback(as, reg);
+			if (result) {
+				break;
+			}
+		}
+
+		reg->readable = (prot & PROT_READ) != 0;
+		reg->writeable = (prot & PROT_WRITE) != 0;
+		reg->executable = (prot & PROT_EXEC) != 0;
+		reg->old_writeable = reg->writeable;
+
+		if (revoke) {
+			vm_protect_range(as, reg->vaddr,
+					 reg->vaddr + reg->memsize);
+		}
+	}
+
+	lock_release(as->pt_lock);
+	return result;
 }
 
+/*
+ * take advice about a range. The access pattern hints are kept in the
+ * regions for vm_fault; WILLNEED reads in whatever would have to come
+ * from a file or swap, and DONTNEED throws the pages away (after
+ * saving any changes to a shared mapping), so the next touch gets them
+ * fresh from the file or as zeroes.
+ */
+int
+as_madvise(struct addrspace *as, vaddr_t vaddr, size_t len, int advice)
+{
+	vaddr_t end;
+	int result;
+
+	switch (advice) {
+	    case MADV_NORMAL:
+	    case MADV_RANDOM:
+	    case MADV_SEQUENTIAL:
+	    case MADV_WILLNEED:
+	    case MADV_DONTNEED:
+		break;
+	    default:
+		return EINVAL;
+	}
+	result = as_user_range(vaddr, len, &end);
+	if (result || len == 0) {
+		return result;
+	}
+
+	lock_acquire(as->pt_lock);
+
+	if (advice == MADV_WILLNEED || advice == MADV_DONTNEED) {
+		/* nothing is kept per region, so no need to split */
+		result = as_range_mapped(as, vaddr, end) ? 0 : ENOMEM;
+	}
+	else {
+		result = as_split_range(as, vaddr, end);
+	}
+
+	for (unsigned i = as_region_index(as, vaddr);
+	     result == 0 && i < regionarray_num(&as->regions); i++) {
+		struct region *reg = regionarray_get(&as->regions, i);
+		vaddr_t start = reg->vaddr < vaddr ? vaddr : reg->vaddr;
+		vaddr_t stop = reg->vaddr + reg->memsize;
+		if (reg->vaddr >= end) {
+			break;
+		}
+		if (stop > end) {
+			stop = end;
+		}
+
+		switch (advice) {
+		    case MADV_WILLNEED:
+			/* only a hint: give up quietly if memory is short */
+			for (vaddr_t va = start; va < stop; va += PAGE_SIZE) {
+				if (vm_prefault(as, reg, va)) {
+					break;
+				}
+			}
+			break;
+		    case MADV_DONTNEED:
+			if (reg->shared) {
+				result = vm_writeback(as, reg);
+			}
+			if (result == 0) {
+				vm_unmap_range(as, start, stop);
+			}
+			break;
+		    default:
+			reg->advice = advice;
+			break;
+		}
+	}
+
+	lock_release(as->pt_lock);
+	return result;
+}
@@ -0,0 +1,368 @@
+/*
+ * Page tables.
+ *
+ * The rest of the VM system only deals in page table entries (see
+ * <vm.h> for what goes in one); this file decides where they live.
+ * By default every address space has a two-level table indexed by
+ * the top 10 and next 10 bits of the address. With options hashpt
+ * there is instead one hash table for the whole system, sized to
+ * physical memory and keyed by address space and page, with an entry
+ * allocated only for each page that is actually in use.
+ *
+ * Except for pt_create and pt_destroy, everything here is called with
+ * the address space's page table lock held.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include "opt-hashpt.h"
+
+#if OPT_HASHPT
+
+/*
+ * One entry per page in use. Each is on the hash chain for its
+ * (address space, page) and on its address space's list, which is
+ * how pt_copy and pt_destroy find them all.
+ */
+struct hpte {
+	struct addrspace *h_as;
+	vaddr_t h_vaddr;		/* page address */
+	paddr_t h_pte;
+	struct hpte *h_next;		/* hash chain */
+	struct hpte *h_asnext;		/* address space list */
+	struct hpte **h_asprev;
+};
+
+static struct hpte **hpt_buckets;
+static unsigned hpt_mask;		/* number of buckets - 1 */
+
+/*
+ * The chains are shared by all address spaces, so they have a lock of
+ * their own. An entry's contents, and whether it exists, are covered
+ * by its address space's page table lock as usual.
+ */
+static struct spinlock hpt_lock = SPINLOCK_INITIALIZER;
+
+static
+unsigned
+hpt_hash(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t key = (vaddr / PAGE_SIZE) ^ ((uintptr_t)as >> 4);
+
+	/* Knuth's multiplicative hash */
+	return (key * 2654435761U) & hpt_mask;
+}
+
+static
+struct hpte *
+hpt_find(struct addrspace *as, vaddr_t vaddr)
+{
+	struct hpte *h;
+
+	spinlock_acquire(&hpt_lock);
+	for (h = hpt_buckets[hpt_hash(as, vaddr)]; h != NULL; h = h->h_next) {
+		if (h->h_as == as && h->h_vaddr == vaddr) {
+			break;
+		}
+	}
+	spinlock_release(&hpt_lock);
+	return h;
+}
+
+static
+void
+hpt_remove(struct hpte *h)
+{
+	struct hpte **p;
+
+	spinlock_acquire(&hpt_lock);
+	p = &hpt_buckets[hpt_hash(h->h_as, h->h_vaddr)];
+	while (*p != h) {
+		p = &(*p)->h_next;
+	}
+	*p = h->h_next;
+	spinlock_release(&hpt_lock);
+
+	*h->h_asprev = h->h_asnext;
+	if (h->h_asnext != NULL) {
+		h->h_asnext->h_asprev = h->h_asprev;
+	}
+	kfree(h);
+}
+
+/*
+ * One bucket per frame of RAM, rounded up to a power of two, so the
+ * chains stay about one entry long while memory isn't overcommitted.
+ */
+void
+pt_bootstrap(void)
+{
+	unsigned nframes = ram_getsize() / PAGE_SIZE;
+	unsigned nbuckets = 1;
+
+	while (nbuckets < nframes) {
+		nbuckets *= 2;
+	}
+	hpt_buckets = kmalloc(nbuckets * sizeof(struct hpte *));
+	if (hpt_buckets == NULL) {
+		panic("pt_bootstrap: out of memory\n");
+	}
+	bzero(hpt_buckets, nbuckets * sizeof(struct hpte *));
+	hpt_mask = nbuckets - 1;
+}
+
+int
+pt_create(struct addrspace *as)
+{
+	as->hpt_entries = NULL;
+	return 0;
+}
+
+void
+pt_destroy(struct addrspace *as)
+{
+	while (as->hpt_entries != NULL) {
+		vm_free_pte(as->hpt_entries->h_pte);
+		hpt_remove(as->hpt_entries);
+	}
+}
+
+paddr_t *
+pt_lookup(struct addrspace *as, vaddr_t vaddr)
+{
+	struct hpte *h = hpt_find(as, vaddr & PAGE_FRAME);
+
+	return h == NULL ? NULL : &h->h_pte;
+}
+
+paddr_t *
+pt_alloc(struct addrspace *as, vaddr_t vaddr)
+{
+	struct hpte *h;
+	unsigned bucket;
+
+	vaddr &= PAGE_FRAME;
+	h = hpt_find(as, vaddr);
+	if (h != NULL) {
+		return &h->h_pte;
+	}
+
+	h = kmalloc(sizeof(struct hpte));
+	if (h == NULL) {
+		return NULL;
+	}
+	h->h_as = as;
+	h->h_vaddr = vaddr;
+	h->h_pte = 0;
+
+	h->h_asnext = as->hpt_entries;
+	h->h_asprev = &as->hpt_entries;
+	if (h->h_asnext != NULL) {
+		h->h_asnext->h_asprev = &h->h_asnext;
+	}
+	as->hpt_entries = h;
+
+	bucket = hpt_hash(as, vaddr);
+	spinlock_acquire(&hpt_lock);
+	h->h_next = hpt_buckets[bucket];
+	hpt_buckets[bucket] = h;
+	spinlock_release(&hpt_lock);
+
+	return &h->h_pte;
+}
+
+void
+pt_release(struct addrspace *as, vaddr_t vaddr)
+{
+	struct hpte *h = hpt_find(as, vaddr & PAGE_FRAME);
+
+	KASSERT(h != NULL && h->h_pte == 0);
+	hpt_remove(h);
+}
+
+paddr_t *
+pt_next(struct addrspace *as, vaddr_t *vaddr, vaddr_t end)
+{
+	paddr_t *pte;
+
+	for (; *vaddr < end; *vaddr += PAGE_SIZE) {
+		pte = pt_lookup(as, *vaddr);
+		if (pte != NULL && *pte != 0) {
+			return pte;
+		}
+	}
+	return NULL;
+}
+
+int
+pt_copy(struct addrspace *old, struct addrspace *newas)
+{
+	struct hpte *h;
+	paddr_t *pte;
+	int result;
+
+	for (h = old->hpt_entries; h != NULL; h = h->h_asnext) {
+		if (h->h_pte == 0) {
+			continue;
+		}
+		pte = pt_alloc(newas, h->h_vaddr);
+		if (pte == NULL) {
+			return ENOMEM;
+		}
+		result = vm_copy_pte(&h->h_pte, pte);
+		if (result) {
+			pt_release(newas, h->h_vaddr);
+			return result;
+		}
+	}
+	return 0;
+}
+
+#else /* !OPT_HASHPT */
+
+/*
+ * Two-level table. Both levels are whole frames straight from the
+ * frame allocator, zeroed, which is also an empty table. pt_used
+ * counts the entries handed out in each level 2 table so it can be
+ * given back as soon as the last one is released.
+ */
+
+void
+pt_bootstrap(void)
+{
+	/* nothing global */
+}
+
+int
+pt_create(struct addrspace *as)
+{
+	as->pagetable = (paddr_t **) alloc_zeroed_kpage();
+	if (as->pagetable == NULL) {
+		return ENOMEM;
+	}
+
+	as->pt_used = kmalloc(PT_SIZE * sizeof(uint16_t));
+	if (as->pt_used == NULL) {
+		free_kpages((vaddr_t)as->pagetable);
+		return ENOMEM;
+	}
+	bzero(as->pt_used, PT_SIZE * sizeof(uint16_t));
+	return 0;
+}
+
+void
+pt_destroy(struct addrspace *as)
+{
+	for (int i = 0; i < PT_SIZE; i++) {
+		if (as->pagetable[i] != NULL) {
+			for (int j = 0; j < PT_SIZE; j++) {
+				vm_free_pte(as->pagetable[i][j]);
+			}
+			free_kpages((vaddr_t)as->pagetable[i]);
+		}
+	}
+	free_kpages((vaddr_t)as->pagetable);
+	kfree(as->pt_used);
+}
+
+paddr_t *
+pt_lookup(struct addrspace *as, vaddr_t vaddr)
+{
+	paddr_t *l2 = as->pagetable[PT1_INDEX(vaddr)];
+
+	return l2 == NULL ? NULL : &l2[PT2_INDEX(vaddr)];
+}
+
+paddr_t *
+pt_alloc(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t pt1 = PT1_INDEX(vaddr);
+
+	if (as->pagetable[pt1] == NULL) {
+		vaddr_t table = alloc_zeroed_kpage();
+		if (table == 0) {
+			return NULL;
+		}
+		as->pagetable[pt1] = (paddr_t *) table;
+	}
+
+	paddr_t *pte = &as->pagetable[pt1][PT2_INDEX(vaddr)];
+	if (*pte == 0) {
+		as->pt_used[pt1]++;
+	}
+	return pte;
+}
+
+void
+pt_release(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t pt1 = PT1_INDEX(vaddr);
+
+	KASSERT(as->pagetable[pt1] != NULL);
+	KASSERT(as->pagetable[pt1][PT2_INDEX(vaddr)] == 0);
+	KASSERT(as->pt_used[pt1] > 0);
+
+	as->pt_used[pt1]--;
+	if (as->pt_used[pt1] == 0) {
+		free_kpages((vaddr_t)as->pagetable[pt1]);
+		as->pagetable[pt1] = NULL;
+	}
+}
+
+paddr_t *
+pt_next(struct addrspace *as, vaddr_t *vaddr, vaddr_t end)
+{
+	while (*vaddr < end) {
+		paddr_t *l2 = as->pagetable[PT1_INDEX(*vaddr)];
+		if (l2 == NULL) {
+			/* on to the first page of the next table */
+			vaddr_t next = (*vaddr | (PT_SIZE * PAGE_SIZE - 1)) + 1;
+			if (next == 0) {
+				break;
+			}
+			*vaddr = next;
+			continue;
+		}
+		if (l2[PT2_INDEX(*vaddr)] != 0) {
+			return &l2[PT2_INDEX(*vaddr)];
+		}
+		*vaddr += PAGE_SIZE;
+	}
+	return NULL;
+}
+
+int
+pt_copy(struct addrspace *old, struct addrspace *newas)
+{
+	for (int i = 0; i < PT_SIZE; i++) {
+		if (old->pagetable[i] == NULL) {
+			continue;
+		}
+
+		vaddr_t table = alloc_zeroed_kpage();
+		if (table == 0) {
+			return ENOMEM;
+		}
+		newas->pagetable[i] = (paddr_t *) table;
+
+		for (int j = 0; j < PT_SIZE; j++) {
+			if (old->pagetable[i][j] == 0) {
+				continue;
+			}
+			int result = vm_copy_pte(&old->pagetable[i][j],
+						 &newas->pagetable[i][j]);
+			if (result) {
+				return result;
+			}
+			newas->pt_used[i]++;
+		}
+	}
+	return 0;
+}
+
+#endif /* OPT_HASHPT */
@@ -0,0 +1,248 @@
+/*
+ * Shared memory segments.
+ *
+ * Segments live in a table indexed by id; an id is reused once its
+ * segment has been removed. A segment counts the regions attached to
+ * it rather than processes, so mprotect splitting an attachment or
+ * fork copying one just adds to the count.
+ *
+ * shm_lock covers the table and every segment. It is taken with the
+ * page table lock of the faulting address space held, never the
+ * other way round.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/shm.h>
+#include <lib.h>
+#include <array.h>
+#include <synch.h>
+#include <vm.h>
+#include <shm.h>
+
+struct shmseg {
+	int shm_key;			/* IPC_PRIVATE if it has no name */
+	unsigned shm_npages;
+	paddr_t *shm_frames;		/* 0 until first touched */
+	unsigned shm_attached;		/* regions that map it */
+	bool shm_removed;		/* no longer in the table */
+};
+
+static struct array *shm_table;		/* of struct shmseg, or NULL */
+static struct lock *shm_lock;
+
+void
+shm_bootstrap(void)
+{
+	shm_table = array_create();
+	shm_lock = lock_create("shm");
+	if (shm_table == NULL || shm_lock == NULL) {
+		panic("shm_bootstrap: out of memory\n");
+	}
+}
+
+static
+void
+shm_destroy(struct shmseg *seg)
+{
+	KASSERT(seg->shm_removed && seg->shm_attached == 0);
+
+	for (unsigned i = 0; i < seg->shm_npages; i++) {
+		if (seg->shm_frames[i] != 0) {
+			free_kpages(PADDR_TO_KVADDR(seg->shm_frames[i]));
+		}
+	}
+	kfree(seg->shm_frames);
+	kfree(seg);
+}
+
+static
+int
+shm_create(int key, size_t size, int *id)
+{
+	struct shmseg *seg;
+	unsigned i, num;
+	int result;
+
+	seg = kmalloc(sizeof(struct shmseg));
+	if (seg == NULL) {
+		return ENOMEM;
+	}
+	seg->shm_key = key;
+	seg->shm_npages = ROUNDUP(size, PAGE_SIZE) / PAGE_SIZE;
+	seg->shm_attached = 0;
+	seg->shm_removed = false;
+	seg->shm_frames = kmalloc(seg->shm_npages * sizeof(paddr_t));
+	if (seg->shm_frames == NULL) {
+		kfree(seg);
+		return ENOMEM;
+	}
+	bzero(seg->shm_frames, seg->shm_npages * sizeof(paddr_t));
+
+	/* take the first free id */
+	num = array_num(shm_table);
+	for (i = 0; i < num; i++) {
+		if (array_get(shm_table, i) == NULL) {
+			break;
+		}
+	}
+	if (i == num) {
+		result = array_add(shm_table, seg, &i);
+		if (result) {
+			kfree(seg->shm_frames);
+			kfree(seg);
+			return result;
+		}
+	}
+	else {
+		array_set(shm_table, i, seg);
+	}
+
+	*id = i;
+	return 0;
+}
+
+int
+shm_get(int key, size_t size, int flags, int *id)
+{
+	struct shmseg *seg;
+	unsigned i;
+	int result;
+
+	lock_acquire(shm_lock);
+
+	if (key != IPC_PRIVATE) {
+		for (i = 0; i < array_num(shm_table); i++) {
+			seg = array_get(shm_table, i);
+			if (seg == NULL || seg->shm_key != key) {
+				continue;
+			}
+			if ((flags & IPC_CREAT) && (flags & IPC_EXCL)) {
+				result = EEXIST;
+			}
+			else if (size > seg->shm_npages * PAGE_SIZE) {
+				result = EINVAL;
+			}
+			else {
+				*id = i;
+				result = 0;
+			}
+			lock_release(shm_lock);
+			return result;
+		}
+		if ((flags & IPC_CREAT) == 0) {
+			lock_release(shm_lock);
+			return ENOENT;
+		}
+	}
+
+	/* size_t wraps before ROUNDUP notices */
+	if (size == 0 || size > (size_t)MIPS_KSEG0) {
+		lock_release(shm_lock);
+		return EINVAL;
+	}
+	result = shm_create(key, size, id);
+	lock_release(shm_lock);
+	return result;
+}
+
+int
+shm_attach(int id, struct shmseg **ret, size_t *size)
+{
+	struct shmseg *seg;
+
+	lock_acquire(shm_lock);
+	if (id < 0 || (unsigned)id >= array_num(shm_table) ||
+	    (seg = array_get(shm_table, id)) == NULL) {
+		lock_release(shm_lock);
+		return EINVAL;
+	}
+	seg->shm_attached++;
+	lock_release(shm_lock);
+
+	*ret = seg;
+	*size = seg->shm_npages * PAGE_SIZE;
+	return 0;
+}
+
+void
+shm_incref(struct shmseg *seg)
+{
+	lock_acquire(shm_lock);
+	KASSERT(seg->shm_attached > 0);
+	seg->shm_attached++;
+	lock_release(shm_lock);
+}
+
+void
+shm_detach(struct shmseg *seg)
+{
+	bool destroy;
+
+	lock_acquire(shm_lock);
+	KASSERT(seg->shm_attached > 0);
+	seg->shm_attached--;
+	destroy = seg->shm_removed && seg->shm_attached == 0;
+	lock_release(shm_lock);
+
+	if (destroy) {
+		shm_destroy(seg);
+	}
+}
+
+int
+shm_remove(int id)
+{
+	struct shmseg *seg;
+	bool destroy;
+
+	lock_acquire(shm_lock);
+	if (id < 0 || (unsigned)id >= array_num(shm_table) ||
+	    (seg = array_get(shm_table, id)) == NULL) {
+		lock_release(shm_lock);
+		return EINVAL;
+	}
+	array_set(shm_table, id, NULL);
+	seg->shm_removed = true;
+	destroy = seg->shm_attached == 0;
+	lock_release(shm_lock);
+
+	if (destroy) {
+		shm_destroy(seg);
+	}
+	return 0;
+}
+
+int
+shm_getpage(struct shmseg *seg, unsigned index, paddr_t *ret)
+{
+	vaddr_t page;
+
+	KASSERT(index < seg->shm_npages);
+
+	lock_acquire(shm_lock);
+	if (seg->shm_frames[index] == 0) {
+		/*
+		 * Not with shm_lock held: getting a frame may mean
+		 * swapping or the OOM killer, which can take a while.
+		 */
+		lock_release(shm_lock);
+		page = vm_alloc_upage(true);
+		if (page == 0) {
+			return ENOMEM;
+		}
+		lock_acquire(shm_lock);
+		if (seg->shm_frames[index] == 0) {
+			/* no owner, so this one is never evicted */
+			seg->shm_frames[index] = KVADDR_TO_PADDR(page) & PAGE_FRAME;
+		}
+		else {
+			/* someone else got there first */
+			free_kpages(page);
+		}
+	}
+	frame_incref(seg->shm_frames[index]);
+	*ret = seg->shm_frames[index];
+	lock_release(shm_lock);
+	return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Swap space.
+ *
+ * The swap device is a raw disk split into page-sized slots, with a
+ * bitmap recording which slots are in use. Pages are written out by
+ * swap_evict() when the frame allocator runs dry, and read back by
+ * vm_fault() when a swapped-out page is touched again.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <current.h>
+#include <cpu.h>
+#include <thread.h>
+#include <mips/tlb.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <swap.h>
+
+static struct vnode *swap_vnode;	/* NULL if running without swap */
+static struct bitmap *swap_map;		/* one bit per slot */
+static unsigned swap_nslots;
+static struct spinlock swap_map_lock = SPINLOCK_INITIALIZER;
+
+/* bounce buffer for swap_copy, and the lock that protects it */
+static void *swap_buffer;
+static struct lock *swap_buffer_lock;
+
+void
+swap_bootstrap(void)
+{
+	char path[] = SWAP_DEVICE;
+	struct stat st;
+	int result;
+
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: no %s (%s), running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat %s: %s\n", SWAP_DEVICE, strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	swap_map = bitmap_create(swap_nslots);
+	swap_buffer = kmalloc(PAGE_SIZE);
+	swap_buffer_lock = lock_create("swap_buffer");
+	if (swap_map == NULL || swap_buffer == NULL ||
+	    swap_buffer_lock == NULL) {
+		panic("swap: out of memory\n");
+	}
+
+	kprintf("swap: %uk on %s\n", swap_nslots * (PAGE_SIZE / 1024),
+		SWAP_DEVICE);
+}
+
+static
+int
+swap_alloc_slot(unsigned *slot)
+{
+	int result;
+
+	spinlock_acquire(&swap_map_lock);
+	result = bitmap_alloc(swap_map, slot);
+	spinlock_release(&swap_map_lock);
+
+	return result;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_map_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	spinlock_release(&swap_map_lock);
+}
+
+/*
+ * Move one page between kernel memory at KBUF and SLOT.
+ */
+static
+int
+swap_io(void *kbuf, unsigned slot, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, kbuf, PAGE_SIZE, (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_out(paddr_t frame, unsigned *slot)
+{
+	int result;
+
+	if (swap_vnode == NULL) {
+		return ENOMEM;
+	}
+
+	result = swap_alloc_slot(slot);
+	if (result) {
+		return result;
+	}
+
+	result = swap_io((void *)PADDR_TO_KVADDR(frame & PAGE_FRAME), *slot,
+			 UIO_WRITE);
+	if (result) {
+		swap_free(*slot);
+		return result;
+	}
+	return 0;
+}
+
+int
+swap_in(unsigned slot, paddr_t frame)
+{
+	int result;
+
+	result = swap_io((void *)PADDR_TO_KVADDR(frame & PAGE_FRAME), slot,
+			 UIO_READ);
+	if (result) {
+		return result;
+	}
+	swap_free(slot);
+	return 0;
+}
+
+int
+swap_copy(unsigned slot, unsigned *newslot)
+{
+	int result;
+
+	result = swap_alloc_slot(newslot);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(swap_buffer_lock);
+	result = swap_io(swap_buffer, slot, UIO_READ);
+	if (result == 0) {
+		result = swap_io(swap_buffer, *newslot, UIO_WRITE);
+	}
+	lock_release(swap_buffer_lock);
+
+	if (result) {
+		swap_free(*newslot);
+	}
+	return result;
+}
+
+/*
+ * Free up one frame by writing a user page out to swap.
+ *
+ * The victim's page table lock is held for the whole operation, so
+ * its owner cannot fault the page back in while it is on its way out.
+ * The entry is invalidated in every TLB before the page is copied so
+ * nobody can write to it behind our back.
+ *
+ * We may need to sleep (on the disk, and waiting for other CPUs to
+ * drop the translation), so give up straight away if that isn't
+ * allowed in the current context.
+ */
+int
+swap_evict(void)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t frame, *pte;
+	bool took_lock;
+	unsigned slot;
+	int result;
+
+	if (swap_vnode == NULL || curthread->t_in_interrupt ||
+	    curcpu->c_spinlocks > 0) {
+		return ENOMEM;
+	}
+
+	frame = frame_pick_victim(&as, &vaddr, &took_lock);
+	if (frame == 0) {
+		return ENOMEM;
+	}
+
+	pte = pt_lookup(as, vaddr);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & TLBLO_VALID) && (*pte & PAGE_FRAME) == frame);
+
+	*pte &= ~TLBLO_VALID;
+	vm_tlb_invalidate(as, vaddr);
+
+	result = swap_out(frame, &slot);
+	if (result) {
+		*pte |= TLBLO_VALID;
+		frame_unbusy(frame);
+	}
+	else {
+		*pte = PTE_MKSWAP(slot);
+		as->rss--;
+		/* still under the owner's lock, so nobody else picks it */
+		free_kpages(PADDR_TO_KVADDR(frame));
+	}
+
+	if (took_lock) {
+		lock_release(as->pt_lock);
+	}
+	return result;
+}
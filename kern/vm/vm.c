@@ -1,5 +1,6 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <thread.h>
 #include <addrspace.h>
@@ -7,72 +8,264 @@
 #include <machine/tlb.h>
 #include <current.h>
 #include <spl.h>
+#include <spinlock.h>
 #include <proc.h>
 #include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <cpu.h>
+#include <swap.h>
+#include <shm.h>
+#include "opt-tlbrr.h"
+#include "opt-tlbnru.h"
 
 /* Place your page table functions here */
 
+/* serialises cross-cpu TLB shootdowns; see vm_tlb_invalidate */
+static struct lock *shootdown_lock;
+static struct semaphore *shootdown_sem;
 
-int vm_add_l1_entry(paddr_t **pagetable, uint32_t pt1_index) {
-    
-    pagetable[pt1_index] = kmalloc(PT_SIZE * (sizeof(paddr_t)));
+/*
+ * ASID allocator. ASIDs are handed out in order from 1 (0 is left
+ * for cpus that have not run a process yet) and are not reused
+ * until they run out. Then the generation is bumped and everyone has
+ * to get a new one; each cpu flushes its TLB the first time it sees
+ * the new generation, which is the only time the TLB is flushed.
+ */
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static unsigned asid_generation = 1;
+static unsigned asid_next = 1;
+
+/*
+ * One frame of zeroes shared read-only by every untouched anonymous
+ * page that has only been read. It carries a spare reference, so it
+ * never looks private to the COW or eviction code, and it is never
+ * reference counted per mapping or freed.
+ */
+static paddr_t zero_frame;
 
-    if (pagetable[pt1_index] == NULL) {
+
+/*
+ * Fill a page table entry with a freshly zeroed frame.
+ */
+static int vm_new_page(paddr_t *pte, uint32_t dirty) {
+
+    // comes zeroed, usually from the pool idle cpus keep filled
+    vaddr_t v_page_addrs = vm_alloc_upage(true);
+    if (v_page_addrs == 0) {
         return ENOMEM;
     }
+    // get physical frame number from virtual page number
+    paddr_t p_frame_num = KVADDR_TO_PADDR(v_page_addrs) & PAGE_FRAME;
+
+    *pte = p_frame_num | dirty | TLBLO_VALID;
+
+    return 0;
+}
+
+/*
+ * Give newpte the page in oldpte for as_copy. A mapped page is shared
+ * copy-on-write: both entries lose TLBLO_DIRTY and the frame gains a
+ * reference; the first write to either copy goes through
+ * VM_FAULT_READONLY, which copies the page then (or just sets the
+ * dirty bit again if it is the last one). A page out in swap gets a
+ * copy of its swap slot instead. newpte is left empty on failure.
+ * The caller must flush stale writable entries of old from the TLB.
+ */
+int vm_copy_pte(paddr_t *oldpte, paddr_t *newpte) {
+
+    if (PTE_IS_SWAPPED(*oldpte)) {
+        // swap slots are not shared; give the child its own copy
+        unsigned slot;
+        int result = swap_copy(PTE_SWAP_SLOT(*oldpte), &slot);
+        if (result) {
+            return result;
+        }
+        *newpte = PTE_MKSWAP(slot);
+        return 0;
+    }
+    if (*oldpte != 0) {
+        *oldpte &= ~TLBLO_DIRTY;
+        if ((*oldpte & PAGE_FRAME) != zero_frame) {
+            frame_incref(*oldpte & PAGE_FRAME);
+        }
+    }
+    *newpte = *oldpte;
+    return 0;
+}
+
+/*
+ * Resolve a write to a copy-on-write page. If nobody else references
+ * the frame any more it is simply made writeable again, otherwise the
+ * page is copied into a private frame and the shared one released.
+ */
+static int vm_cow_break(struct addrspace *as, vaddr_t vaddr, paddr_t *pte) {
+
+    paddr_t old_frame = *pte & PAGE_FRAME;
+
+    if (old_frame == zero_frame) {
+        // first write to a page that has only been read so far
+        vaddr_t v_page_addrs = vm_alloc_upage(true);
+        if (v_page_addrs == 0) {
+            return ENOMEM;
+        }
+        *pte = (KVADDR_TO_PADDR(v_page_addrs) & PAGE_FRAME) | TLBLO_DIRTY | TLBLO_VALID;
+        frame_set_owner(*pte & PAGE_FRAME, as, vaddr);
+        as->rss++;
+        vm_tlb_invalidate(as, vaddr);
+        return 0;
+    }
+
+    if (frame_refcount(old_frame) == 1) {
+        *pte |= TLBLO_DIRTY;
+        frame_set_owner(old_frame, as, vaddr);
+        return 0;
+    }
 
-    // initialize all pt1 level 2 to 0
-    for (int i = 0; i < PT_SIZE; i++) {
-        pagetable[pt1_index][i] = 0;
+    vaddr_t v_page_addrs = vm_alloc_upage(false);
+    if (v_page_addrs == 0) {
+        return ENOMEM;
     }
+    memmove((void *) v_page_addrs, (const void *) PADDR_TO_KVADDR(old_frame), PAGE_SIZE);
+    *pte = (KVADDR_TO_PADDR(v_page_addrs) & PAGE_FRAME) | TLBLO_DIRTY | TLBLO_VALID;
+    frame_set_owner(*pte & PAGE_FRAME, as, vaddr);
+
+    // a cpu we ran on before may still map the shared frame
+    vm_tlb_invalidate(as, vaddr);
+
+    // drop our reference to the shared frame
+    free_kpages(PADDR_TO_KVADDR(old_frame));
 
     return 0;
 }
 
-int vm_add_l2_entry(paddr_t **pagetable, uint32_t pt1_index, uint32_t pt2_index, uint32_t dirty) {
+/*
+ * Bring a page back in from swap. The allocation may itself push
+ * other pages out, but never this one, since it isn't resident.
+ */
+static int vm_swap_in(struct addrspace *as, vaddr_t vaddr, paddr_t *pte, uint32_t dirty) {
 
-    vaddr_t v_page_addrs = alloc_kpages(1);
+    vaddr_t v_page_addrs = vm_alloc_upage(false);
     if (v_page_addrs == 0) {
         return ENOMEM;
     }
-    bzero((void *) v_page_addrs, PAGE_SIZE);
-    // get physical frame number from virtual page number
+
     paddr_t p_frame_num = KVADDR_TO_PADDR(v_page_addrs) & PAGE_FRAME;
+    int result = swap_in(PTE_SWAP_SLOT(*pte), p_frame_num);
+    if (result) {
+        free_kpages(v_page_addrs);
+        return result;
+    }
 
-    pagetable[pt1_index][pt2_index] = p_frame_num | dirty | TLBLO_VALID;
+    *pte = p_frame_num | dirty | TLBLO_VALID;
+    frame_set_owner(p_frame_num, as, vaddr);
+    as->rss++;
 
     return 0;
 }
 
-int vm_copy_pt(paddr_t **old_pt, paddr_t **new_pt) {
+/*
+ * Release whatever a page table entry holds: a swap slot, a reference
+ * to a frame, or nothing at all for the zero page.
+ */
+void vm_free_pte(paddr_t pte) {
 
-    for (int i = 0; i < PT_SIZE; i++) {
-        if (old_pt[i] == NULL) {
-            new_pt[i] = NULL;
-            continue;
+    if (PTE_IS_SWAPPED(pte)) {
+        swap_free(PTE_SWAP_SLOT(pte));
+    }
+    else if (pte != 0 && (pte & PAGE_FRAME) != zero_frame) {
+        free_kpages(PADDR_TO_KVADDR(pte & PAGE_FRAME));
+    }
+}
+
+/*
+ * How many pages in [start, end) of as are resident, i.e. could have
+ * a translation cached in some TLB.
+ */
+static unsigned vm_count_resident(struct addrspace *as, vaddr_t start, vaddr_t end) {
+
+    unsigned resident = 0;
+    paddr_t *pte;
+    for (vaddr_t va = start; (pte = pt_next(as, &va, end)) != NULL; va += PAGE_SIZE) {
+        if (*pte & TLBLO_VALID) {
+            resident++;
         }
+    }
+    return resident;
+}
 
-        new_pt[i] = kmalloc(PT_SIZE * (sizeof(paddr_t)));
+/*
+ * Before changing many entries of as, decide how to get rid of their
+ * cached translations: small ranges are shot down page by page, but
+ * for a large one it's cheaper to give the (current) address space a
+ * new ASID. Returns true if that has been done.
+ */
+#define UNMAP_SHOOTDOWN_MAX 16
 
-        for (int j = 0; j < PT_SIZE; j++) {
-            if (old_pt[i][j] != 0) {
-                vaddr_t v_page_addrs = alloc_kpages(1);
-                if (v_page_addrs == 0) {
-                    return ENOMEM;
-                }
-                bzero((void *) v_page_addrs, PAGE_SIZE);
-                memmove((void *) v_page_addrs, (const void *) PADDR_TO_KVADDR(old_pt[i][j] & PAGE_FRAME), PAGE_SIZE);
-                // check if old_pt is dirty
-                uint32_t dirty = old_pt[i][j] & TLBLO_DIRTY;               
-                new_pt[i][j] = (KVADDR_TO_PADDR(v_page_addrs) & PAGE_FRAME) | dirty | TLBLO_VALID;             
+static bool vm_flush_range(struct addrspace *as, vaddr_t start, vaddr_t end) {
+
+    if (vm_count_resident(as, start, end) <= UNMAP_SHOOTDOWN_MAX ||
+        as != proc_getas()) {
+        return false;
+    }
+    vm_asid_retire(as);
+    as_activate();
+    return true;
+}
+
+/*
+ * Throw away the pages in [start, end) of as: frames and swap slots
+ * are released and the entries cleared, so the next touch faults in a
+ * fresh zero page. Called with the page table lock held.
+ */
+void vm_unmap_range(struct addrspace *as, vaddr_t start, vaddr_t end) {
+
+    KASSERT(lock_do_i_hold(as->pt_lock));
+    KASSERT((start & ~PAGE_FRAME) == 0 && (end & ~PAGE_FRAME) == 0);
+
+    bool retired = vm_flush_range(as, start, end);
+
+    paddr_t *pte;
+    for (vaddr_t va = start; (pte = pt_next(as, &va, end)) != NULL; va += PAGE_SIZE) {
+        paddr_t old = *pte;
+        *pte = 0;
+        if (old & TLBLO_VALID) {
+            if (!retired) {
+                // nobody may use the frame once it's freed
+                vm_tlb_invalidate(as, va);
             }
-            else {
-                new_pt[i][j] = 0;
+            if ((old & PAGE_FRAME) != zero_frame) {
+                as->rss--;
             }
         }
+        vm_free_pte(old);
+        pt_release(as, va);
     }
-    return 0;
+}
 
+/*
+ * Make the resident pages in [start, end) of as read-only and drop
+ * their translations, so the next access goes through vm_fault and is
+ * checked against the region's (new) permissions. Called with the page
+ * table lock held.
+ */
+void vm_protect_range(struct addrspace *as, vaddr_t start, vaddr_t end) {
+
+    KASSERT(lock_do_i_hold(as->pt_lock));
+    KASSERT((start & ~PAGE_FRAME) == 0 && (end & ~PAGE_FRAME) == 0);
+
+    bool retired = vm_flush_range(as, start, end);
+
+    paddr_t *pte;
+    for (vaddr_t va = start; (pte = pt_next(as, &va, end)) != NULL; va += PAGE_SIZE) {
+        if ((*pte & TLBLO_VALID) == 0) {
+            continue;
+        }
+        *pte &= ~TLBLO_DIRTY;
+        if (!retired) {
+            vm_tlb_invalidate(as, va);
+        }
+    }
 }
 
 void vm_bootstrap(void)
@@ -82,6 +275,407 @@ void vm_bootstrap(void)
      * You may or may not need to add anything here depending what's
      * provided or required by the assignment spec.
      */
+    vaddr_t zero_page = alloc_zeroed_kpage();
+    if (zero_page == 0) {
+        panic("vm_bootstrap: out of memory\n");
+    }
+    zero_frame = KVADDR_TO_PADDR(zero_page) & PAGE_FRAME;
+    // the spare reference keeps it from ever being written or evicted
+    frame_incref(zero_frame);
+
+    shootdown_lock = lock_create("tlb_shootdown");
+    shootdown_sem = sem_create("tlb_shootdown", 0);
+    if (shootdown_lock == NULL || shootdown_sem == NULL) {
+        panic("vm_bootstrap: out of memory\n");
+    }
+
+    pt_bootstrap();
+    shm_bootstrap();
+    swap_bootstrap();
+}
+
+bool vm_idle(void) {
+    return frame_zero_idle();
+}
+
+/*
+ * Out-of-memory killer. When a user page can't be had even by swapping
+ * (swap is full, or there is none), the address space with the most
+ * resident pages is picked and they are taken away on the spot, as if
+ * all of it had been munmap()ed without writing anything back. It is
+ * marked so vm_fault won't bring anything back in, and mips_trap makes
+ * its process exit with SIGKILL the next time it traps in from user
+ * mode. That is soon even if it is just computing: unmapping shoots
+ * its translations down on every cpu it has run on, code included, so
+ * its next instruction fetch misses the TLB. Its ASID is retired as
+ * well, so whatever another cpu's TLB may still hold under the old
+ * one can't match once the victim is next activated; that only takes
+ * effect at its next as_activate(), so it is not what stops it.
+ *
+ * The victim's page table lock is only tried, as in the clock, since
+ * we hold our own. If we are the biggest ourselves our pages can't be
+ * pulled out from under the fault in progress; the fault fails instead
+ * and we exit on the way out.
+ */
+#define OOM_RETRIES 4
+
+static struct spinlock oom_lock = SPINLOCK_INITIALIZER;
+static struct addrspace *oom_all;       // every address space
+
+void vm_oom_register(struct addrspace *as) {
+
+    spinlock_acquire(&oom_lock);
+    as->all_next = oom_all;
+    as->all_prev = &oom_all;
+    if (oom_all != NULL) {
+        oom_all->all_prev = &as->all_next;
+    }
+    oom_all = as;
+    spinlock_release(&oom_lock);
+}
+
+void vm_oom_unregister(struct addrspace *as) {
+
+    spinlock_acquire(&oom_lock);
+    *as->all_prev = as->all_next;
+    if (as->all_next != NULL) {
+        as->all_next->all_prev = as->all_prev;
+    }
+    spinlock_release(&oom_lock);
+}
+
+/*
+ * Free some memory by killing someone. Returns true if it is worth
+ * trying the allocation again.
+ */
+static bool vm_oom_kill(void) {
+
+    struct addrspace *cur = proc_getas();
+    struct addrspace *victim = NULL;
+
+    spinlock_acquire(&oom_lock);
+    for (struct addrspace *as = oom_all; as != NULL; as = as->all_next) {
+        if (!as->oom_killed && (victim == NULL || as->rss > victim->rss)) {
+            victim = as;
+        }
+    }
+    if (victim == NULL || victim->rss == 0) {
+        spinlock_release(&oom_lock);
+        return false;
+    }
+    if (victim == cur) {
+        victim->oom_killed = true;
+        spinlock_release(&oom_lock);
+        return false;
+    }
+    // holding its lock also keeps as_destroy from freeing it under us
+    if (!lock_tryacquire(victim->pt_lock)) {
+        spinlock_release(&oom_lock);
+        thread_yield();
+        return true;
+    }
+    victim->oom_killed = true;
+    spinlock_release(&oom_lock);
+
+    kprintf("vm: out of memory, reclaiming %u pages\n", victim->rss);
+    for (unsigned i = 0; i < regionarray_num(&victim->regions); i++) {
+        struct region *reg = regionarray_get(&victim->regions, i);
+        vm_unmap_range(victim, reg->vaddr, reg->vaddr + reg->memsize);
+    }
+    vm_asid_retire(victim);
+    lock_release(victim->pt_lock);
+    return true;
+}
+
+vaddr_t vm_alloc_upage(bool zeroed) {
+
+    for (int tries = 0; ; tries++) {
+        vaddr_t page = alloc_upage(zeroed);
+        if (page != 0 || tries == OOM_RETRIES || !vm_oom_kill()) {
+            return page;
+        }
+    }
+}
+
+bool vm_oom_killed(void) {
+
+    struct addrspace *as = proc_getas();
+    return as != NULL && as->oom_killed;
+}
+
+/*
+ * Does any of the page at vaddr come from the region's file?
+ */
+static bool vm_has_file_data(struct region *reg, vaddr_t vaddr) {
+
+    return reg->vnode != NULL &&
+           vaddr < reg->file_vaddr + reg->filesize &&
+           vaddr + PAGE_SIZE > reg->file_vaddr;
+}
+
+/*
+ * Move the part of the page at vaddr that is backed by the region's
+ * file between the file and the frame. On a read the frame is already
+ * zeroed, and anything past filesize is the bss and stays zero.
+ */
+static int vm_file_io(struct region *reg, vaddr_t vaddr, paddr_t frame, enum uio_rw rw) {
+
+    struct iovec iov;
+    struct uio ku;
+
+    vaddr_t start = vaddr;
+    vaddr_t end = vaddr + PAGE_SIZE;
+    if (start < reg->file_vaddr) {
+        start = reg->file_vaddr;
+    }
+    if (end > reg->file_vaddr + reg->filesize) {
+        end = reg->file_vaddr + reg->filesize;
+    }
+    if (start >= end) {
+        return 0;
+    }
+
+    void *kbuf = (void *) (PADDR_TO_KVADDR(frame & PAGE_FRAME) + (start - vaddr));
+    uio_kinit(&iov, &ku, kbuf, end - start,
+              reg->file_offset + (start - reg->file_vaddr), rw);
+
+    int result;
+    if (rw == UIO_READ) {
+        result = VOP_READ(reg->vnode, &ku);
+    }
+    else {
+        result = VOP_WRITE(reg->vnode, &ku);
+    }
+    if (result) {
+        return result;
+    }
+    if (ku.uio_resid != 0) {
+        if (rw == UIO_WRITE) {
+            return EIO;
+        }
+        if (!reg->mmapped) {
+            kprintf("vm: short read on executable - file truncated?\n");
+            return ENOEXEC;
+        }
+        // a mapped file that has shrunk since: the rest reads as zero
+    }
+    return 0;
+}
+
+/*
+ * Write the modified pages of a shared file mapping back to the file
+ * and mark them clean, so the next write faults and dirties them
+ * again. Pages out in swap are brought back in first, since whether
+ * they were modified was lost on the way out. Called with the page
+ * table lock held.
+ */
+int vm_writeback(struct addrspace *as, struct region *reg) {
+
+    KASSERT(lock_do_i_hold(as->pt_lock));
+    KASSERT(reg->shared && reg->vnode != NULL);
+
+    // the region may be only part of the mapping, after an mprotect
+    vaddr_t end = reg->file_vaddr + reg->filesize;
+    if (end > reg->vaddr + reg->memsize) {
+        end = reg->vaddr + reg->memsize;
+    }
+    paddr_t *pte;
+    for (vaddr_t va = reg->vaddr; (pte = pt_next(as, &va, end)) != NULL; va += PAGE_SIZE) {
+        if (PTE_IS_SWAPPED(*pte)) {
+            int result = vm_swap_in(as, va, pte, TLBLO_DIRTY);
+            if (result) {
+                return result;
+            }
+        }
+        if ((*pte & TLBLO_DIRTY) == 0) {
+            continue;
+        }
+
+        // clean it first, so a write during the I/O dirties it again
+        *pte &= ~TLBLO_DIRTY;
+        vm_tlb_invalidate(as, va);
+
+        // the write may have to evict something; not this page. A
+        // frame still shared after fork needs no pin, as it has no
+        // owner for the clock to find, and the other side may be
+        // writing it back too. Sharing it takes our lock, so the
+        // count can't go back up meanwhile.
+        bool pin = frame_refcount(*pte & PAGE_FRAME) == 1;
+        if (pin) {
+            frame_pin(*pte & PAGE_FRAME);
+        }
+        int result = vm_file_io(reg, va, *pte, UIO_WRITE);
+        if (pin) {
+            frame_unpin(*pte & PAGE_FRAME);
+        }
+        if (result) {
+            *pte |= TLBLO_DIRTY;
+            return result;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Bring in a page that isn't resident: untouched pages come from the
+ * file or as zeroes (the shared zero page if only read), swapped ones
+ * from swap. pte is the page's entry from pt_alloc; if it is still
+ * empty after a failure, the caller should pt_release it.
+ */
+static int vm_page_in(struct addrspace *as, struct region *reg, vaddr_t vaddr, paddr_t *pte, int faulttype) {
+
+    uint32_t dirty = 0;
+
+    if (PTE_IS_SWAPPED(*pte)) {
+        // whether a shared page was modified is lost on the way out,
+        // so assume it was
+        if (reg->writeable) {
+            dirty = TLBLO_DIRTY;
+        }
+        return vm_swap_in(as, vaddr, pte, dirty);
+    }
+
+    KASSERT(*pte == 0);
+    if (reg->shm != NULL) {
+        // the segment's own frame, so every process sees the same page
+        paddr_t frame;
+        int result = shm_getpage(reg->shm, (vaddr - reg->file_vaddr) / PAGE_SIZE, &frame);
+        if (result) {
+            return result;
+        }
+        *pte = frame | (reg->writeable ? TLBLO_DIRTY : 0) | TLBLO_VALID;
+        as->rss++;
+        return 0;
+    }
+    if (faulttype == VM_FAULT_READ && !vm_has_file_data(reg, vaddr)) {
+        // reading memory that was never written: it's all zeroes,
+        // so map the shared zero page until the first write
+        *pte = zero_frame | TLBLO_VALID;
+        return 0;
+    }
+
+    // in a shared mapping the dirty bit also says what to write
+    // back, so only set it when the page is actually written
+    if (reg->writeable && (!reg->shared || faulttype != VM_FAULT_READ)) {
+        dirty = TLBLO_DIRTY;
+    }
+
+    // allocate frame, zero fill, insert
+    int check = vm_new_page(pte, dirty);
+    if (check) {
+        return check;
+    }
+    frame_set_owner(*pte & PAGE_FRAME, as, vaddr);
+
+    if (reg->vnode != NULL) {
+        // first touch of a file-backed page: read it in now, pinned
+        // in case the read itself has to evict something
+        frame_pin(*pte & PAGE_FRAME);
+        check = vm_file_io(reg, vaddr, *pte, UIO_READ);
+        frame_unpin(*pte & PAGE_FRAME);
+        if (check) {
+            free_kpages(PADDR_TO_KVADDR(*pte & PAGE_FRAME));
+            *pte = 0;
+            return check;
+        }
+    }
+    as->rss++;
+    return 0;
+}
+
+/*
+ * Bring in the page at vaddr of reg ahead of time, if it would have to
+ * be read from the file or from swap. Untouched anonymous pages are
+ * left alone since they cost nothing to fault in later. Called with
+ * the page table lock held.
+ */
+int vm_prefault(struct addrspace *as, struct region *reg, vaddr_t vaddr) {
+
+    KASSERT(lock_do_i_hold(as->pt_lock));
+
+    vaddr &= PAGE_FRAME;
+    paddr_t *pte = pt_lookup(as, vaddr);
+    if (pte != NULL && *pte != 0) {
+        if (!PTE_IS_SWAPPED(*pte)) {
+            return 0;
+        }
+        // a failure leaves it in swap
+        return vm_page_in(as, reg, vaddr, pte, VM_FAULT_READ);
+    }
+
+    if (!vm_has_file_data(reg, vaddr)) {
+        return 0;
+    }
+    pte = pt_alloc(as, vaddr);
+    if (pte == NULL) {
+        return ENOMEM;
+    }
+    int check = vm_page_in(as, reg, vaddr, pte, VM_FAULT_READ);
+    if (check) {
+        pt_release(as, vaddr);
+    }
+    return check;
+}
+
+/*
+ * A region marked MADV_SEQUENTIAL will want the next few pages soon;
+ * read them in while we're at it. Best effort: stops at the first
+ * failure, which the faulting access doesn't care about.
+ */
+#define VM_READAHEAD 8
+
+static void vm_read_ahead(struct addrspace *as, struct region *reg, vaddr_t vaddr) {
+
+    vaddr_t end = reg->vaddr + reg->memsize;
+
+    for (int i = 0; i < VM_READAHEAD; i++) {
+        vaddr += PAGE_SIZE;
+        if (vaddr >= end || vm_prefault(as, reg, vaddr) != 0) {
+            break;
+        }
+    }
+}
+
+/*
+ * Fault-around: a miss on one page is a good sign that its neighbours
+ * are wanted too, and if they are resident already their misses can
+ * be saved by loading them now. Only the aligned block of
+ * VM_FAULT_AROUND pages around the fault is looked at, and only the
+ * part of it inside the faulting region, whose permissions have just
+ * been checked. Set it to 0 to turn fault-around off.
+ */
+#define VM_FAULT_AROUND 8
+
+static void vm_tlb_insert(uint32_t entryHi, uint32_t entryLo, bool used);
+
+static unsigned vm_fault_around(struct addrspace *as, struct region *reg, vaddr_t vaddr) {
+
+    vaddr_t start = vaddr & ~(vaddr_t)(VM_FAULT_AROUND * PAGE_SIZE - 1);
+    vaddr_t end = start + VM_FAULT_AROUND * PAGE_SIZE;
+    if (start < reg->vaddr) {
+        start = reg->vaddr;
+    }
+    if (end > reg->vaddr + reg->memsize) {
+        end = reg->vaddr + reg->memsize;
+    }
+
+    unsigned loaded = 0;
+    paddr_t *pte;
+    int spl = splhigh();
+    for (vaddr_t va = start; (pte = pt_next(as, &va, end)) != NULL; va += PAGE_SIZE) {
+        if (va == vaddr || (*pte & TLBLO_VALID) == 0) {
+            continue;
+        }
+        uint32_t entryHi = va | TLBHI_ASID(curcpu->c_asid);
+        // never load a second entry for the same page; and these
+        // haven't been used yet, so they are the first to go again
+        if (tlb_probe(entryHi, 0) < 0) {
+            vm_tlb_insert(entryHi, *pte, false);
+            loaded++;
+        }
+    }
+    splx(spl);
+    return loaded;
 }
 
 int
@@ -93,7 +687,6 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
     switch (faulttype) {
 	    case VM_FAULT_READONLY:
-            return EFAULT;
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		    break;
@@ -106,87 +699,295 @@ vm_fault(int faulttype, vaddr_t faultaddress)
     if (as == NULL) {
 		return EFAULT;
 	}
+    if (as->oom_killed) {
+        // our pages are gone; nothing more is brought in before we exit
+        return EFAULT;
+    }
 
-    paddr_t p_frame_num =  KVADDR_TO_PADDR(faultaddress);
-
-    // 2-lvl translation virtual address: |10 bits (first lvl)| 10 bits(second level)| 12 bits(offset)| 
-    uint32_t pt1_bits = p_frame_num >> 22;
-    uint32_t pt2_bits = (p_frame_num << 10) >> 22;
+    faultaddress &= PAGE_FRAME;
 
-    bool alloc_pt1 = false;
     lock_acquire(as->pt_lock);
-    // check if 1-lvl is NULL
-    if (as->pagetable[pt1_bits] == NULL) {
-        int check = vm_add_l1_entry(as->pagetable, pt1_bits);
+
+    // look up region; every access is checked against its current
+    // permissions, since mprotect may have taken them away
+    struct region *cur_reg = as_find_region(as, faultaddress);
+    if (cur_reg == NULL) {
+        // maybe the stack needs to grow
+        cur_reg = as_grow_stack(as, faultaddress, curproc->p_stacklimit.rlim_cur);
+    }
+    if (cur_reg == NULL ||
+        !(cur_reg->readable || cur_reg->writeable || cur_reg->executable) ||
+        (faulttype != VM_FAULT_READ && !cur_reg->writeable)) {
+        lock_release(as->pt_lock);
+        return EFAULT;
+    }
+
+    // find the entry, making an empty one if there is none
+    paddr_t *pte = pt_alloc(as, faultaddress);
+    if (pte == NULL) {
+        lock_release(as->pt_lock);
+        return ENOMEM;
+    }
+    // valid translation
+    bool major = false;
+    if (*pte == 0 || PTE_IS_SWAPPED(*pte)) {
+        // counted as major if it has to wait for the disk
+        major = PTE_IS_SWAPPED(*pte) || vm_has_file_data(cur_reg, faultaddress);
+        int check = vm_page_in(as, cur_reg, faultaddress, pte, faulttype);
         if (check) {
+            // don't keep an entry we have just made for nothing
+            if (*pte == 0) {
+                pt_release(as, faultaddress);
+            }
             lock_release(as->pt_lock);
             return check;
         }
-        alloc_pt1 = true;
+        if (cur_reg->advice == MADV_SEQUENTIAL && cur_reg->vnode != NULL) {
+            vm_read_ahead(as, cur_reg, faultaddress);
+        }
     }
-
-    uint32_t dirty = 0;
-    // valid translation
-    if (as->pagetable[pt1_bits][pt2_bits] == 0) {
-        struct region *cur_reg = as->region_list;
-        // look up region
-        while (cur_reg != NULL) {
-            // check valid region
-            if ((faultaddress >= cur_reg->vaddr) && (faultaddress < cur_reg->vaddr + cur_reg->memsize)) {
-                if (cur_reg->writeable) {
-                    dirty = TLBLO_DIRTY;
-                }
-                else {
-                    dirty = 0;
-                }
-                break;
-            }
-            cur_reg = cur_reg->next;
+    else if (faulttype != VM_FAULT_READ && (*pte & TLBLO_DIRTY) == 0) {
+        // write to a read-only page of a writeable region: COW
+        int check = 0;
+        if ((cur_reg->shared || cur_reg->shm != NULL) &&
+            (*pte & PAGE_FRAME) != zero_frame) {
+            // first write to a clean page of a shared file mapping or
+            // segment; the frame is shared with others on purpose
+            *pte |= TLBLO_DIRTY;
+            frame_touch(*pte & PAGE_FRAME, as, faultaddress);
         }
-
-        // invalid region
-        if (cur_reg == NULL) {
-            if (alloc_pt1) {
-                kfree(as->pagetable[pt1_bits]);
-            }
-            lock_release(as->pt_lock);
-            return EFAULT;
+        else {
+            check = vm_cow_break(as, faultaddress, pte);
         }
-
-        // allocate frame, zero fill, insert
-        int check = vm_add_l2_entry(as->pagetable, pt1_bits, pt2_bits, dirty);
         if (check) {
-            if (alloc_pt1) {
-                kfree(as->pagetable[pt1_bits]);
-            }
             lock_release(as->pt_lock);
             return check;
         }
     }
+    else {
+        // plain TLB miss: tell the clock the page is in use
+        frame_touch(*pte & PAGE_FRAME, as, faultaddress);
+    }
+    if (cur_reg->advice != MADV_RANDOM) {
+        // before the faulting page, so that can't be replaced by these
+        curproc->p_faultaround += vm_fault_around(as, cur_reg, faultaddress);
+    }
+    if (major) {
+        curproc->p_majflt++;
+    }
+    else {
+        curproc->p_minflt++;
+    }
     // load tlb
-    uint32_t entryHi = faultaddress & PAGE_FRAME;
-    uint32_t entryLo = as->pagetable[pt1_bits][pt2_bits];
+    uint32_t entryHi = faultaddress;
+    uint32_t entryLo = *pte;
     load_tlb(entryHi, entryLo);
     lock_release(as->pt_lock);
 
     return 0;
 }
 
+/*
+ * TLB replacement. The hardware can only pick a slot at random, which
+ * may throw out an entry loaded a moment ago, so with options tlbrr or
+ * tlbnru the slot is chosen here instead from the per-cpu shadow of
+ * what each slot holds. NRU sweeps a hand over the slots much like the
+ * frame clock: a free slot goes straight away, then one that hasn't
+ * been loaded since the hand last went past. Entries of other address
+ * spaces age like any others, since with ASIDs they may well be used
+ * again. The hardware doesn't tell us about TLB hits, so "used" only
+ * means loaded by a real fault rather than by fault-around: this is
+ * FIFO with a second chance for those. Interrupts must be off for all
+ * of these.
+ */
+static void vm_tlb_set(unsigned index, uint32_t entryHi, uint32_t entryLo, bool used) {
+
+    struct tlbshadow *ts = &curcpu->c_tlb;
+    uint64_t bit = (uint64_t)1 << index;
+
+    tlb_write(entryHi, entryLo, index);
+    ts->ts_entryhi[index] = entryHi;
+    ts->ts_valid |= bit;
+    if (used) {
+        ts->ts_used |= bit;
+    }
+    else {
+        ts->ts_used &= ~bit;
+    }
+}
+
+static void vm_tlb_clear(unsigned index) {
+
+    struct tlbshadow *ts = &curcpu->c_tlb;
+
+    tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
+    ts->ts_valid &= ~((uint64_t)1 << index);
+}
+
+#if OPT_TLBRR || OPT_TLBNRU
+static unsigned vm_tlb_victim(void) {
+
+    struct tlbshadow *ts = &curcpu->c_tlb;
+    unsigned index;
+
+#if OPT_TLBNRU
+    // two laps clear every used bit, so this always finds one
+    for (int n = 0; n < 2 * NUM_TLB; n++) {
+        index = ts->ts_hand;
+        ts->ts_hand = (index + 1) % NUM_TLB;
+
+        uint64_t bit = (uint64_t)1 << index;
+        if ((ts->ts_valid & bit) == 0 || (ts->ts_used & bit) == 0) {
+            return index;
+        }
+        ts->ts_used &= ~bit;
+    }
+#endif
+
+    index = ts->ts_hand;
+    ts->ts_hand = (index + 1) % NUM_TLB;
+    return index;
+}
+#endif
+
+/*
+ * Load an entry for a page that has none yet.
+ */
+static void vm_tlb_insert(uint32_t entryHi, uint32_t entryLo, bool used) {
+
+#if OPT_TLBRR || OPT_TLBNRU
+    vm_tlb_set(vm_tlb_victim(), entryHi, entryLo, used);
+#else
+    (void)used;
+    tlb_random(entryHi, entryLo);
+#endif
+}
+
 void load_tlb(uint32_t entryHi, uint32_t entryLo) {
     // disable interrupt
     int spl = splhigh();
-    tlb_random(entryHi, entryLo);
+    // always tag with the address space this cpu is running
+    entryHi = (entryHi & TLBHI_VPAGE) | TLBHI_ASID(curcpu->c_asid);
+    // replace a stale entry for the same page (e.g. after a COW break)
+    int index = tlb_probe(entryHi, 0);
+    if (index >= 0) {
+        vm_tlb_set(index, entryHi, entryLo, true);
+    }
+    else {
+        vm_tlb_insert(entryHi, entryLo, true);
+    }
     splx(spl);
 }
 
 /*
- * SMP-specific functions.  Unused in our UNSW configuration.
+ * Make as the address space this cpu's TLB matches against, giving it
+ * an ASID first if it doesn't have one from the current generation.
+ * Its old translations are still in the TLB from the last time it ran
+ * here, unless the ASIDs rolled over in the meantime.
+ */
+void vm_asid_activate(struct addrspace *as) {
+
+    int spl = splhigh();
+
+    spinlock_acquire(&asid_lock);
+    if (as->asid_generation != asid_generation) {
+        if (asid_next == NUM_ASID) {
+            asid_generation++;
+            asid_next = 1;
+        }
+        as->asid = asid_next++;
+        as->asid_generation = asid_generation;
+        as->asid_cpus = 0;
+    }
+    as->asid_cpus |= (uint32_t)1 << curcpu->c_number;
+    unsigned generation = asid_generation;
+    curcpu->c_asid = as->asid;
+    spinlock_release(&asid_lock);
+
+    if (curcpu->c_asid_generation != generation) {
+        for (int i = 0; i < NUM_TLB; i++) {
+            vm_tlb_clear(i);
+        }
+        curcpu->c_asid_generation = generation;
+    }
+    tlb_setentryhi(TLBHI_ASID(curcpu->c_asid));
+
+    splx(spl);
+}
+
+/*
+ * Drop every translation of as from every TLB at once, by making it
+ * take a new ASID the next time it is activated. The old one isn't
+ * handed out again before the next generation flush. The caller
+ * should as_activate() afterwards if as is the current address space.
+ */
+void vm_asid_retire(struct addrspace *as) {
+
+    spinlock_acquire(&asid_lock);
+    as->asid_generation = 0;
+    spinlock_release(&asid_lock);
+}
+
+/*
+ * Drop the translation for vaddr in as from this cpu's TLB only.
+ */
+void vm_tlb_invalidate_local(struct addrspace *as, vaddr_t vaddr) {
+
+    int spl = splhigh();
+    int index = tlb_probe((vaddr & PAGE_FRAME) | TLBHI_ASID(as->asid), 0);
+    if (index >= 0) {
+        vm_tlb_clear(index);
+    }
+    // the probe changed the ASID we are matching against; put it back
+    tlb_setentryhi(TLBHI_ASID(curcpu->c_asid));
+    splx(spl);
+}
+
+/*
+ * Drop the translation for vaddr in as from this cpu's TLB and from
+ * every other cpu that as has run on, and wait until they have all
+ * done so. Used when a mapping that a running process may have cached
+ * goes away.
+ */
+void vm_tlb_invalidate(struct addrspace *as, vaddr_t vaddr) {
+
+    struct tlbshootdown ts;
+    unsigned ncpus;
+
+    vm_tlb_invalidate_local(as, vaddr);
+
+    lock_acquire(shootdown_lock);
+    ts.ts_vaddr = vaddr & PAGE_FRAME;
+    ts.ts_done = shootdown_sem;
+
+    spinlock_acquire(&asid_lock);
+    ts.ts_asid = as->asid;
+    uint32_t cpus = as->asid_cpus;
+    spinlock_release(&asid_lock);
+
+    ncpus = ipi_tlbshootdown_cpus(cpus, &ts);
+    while (ncpus-- > 0) {
+        P(shootdown_sem);
+    }
+    lock_release(shootdown_lock);
+}
+
+/*
+ * SMP-specific functions.
  */
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("vm tried to do tlb shootdown?!\n");
-}
+	int spl, index;
+
+	spl = splhigh();
+	index = tlb_probe(ts->ts_vaddr | TLBHI_ASID(ts->ts_asid), 0);
+	if (index >= 0) {
+		vm_tlb_clear(index);
+	}
+	tlb_setentryhi(TLBHI_ASID(curcpu->c_asid));
+	splx(spl);
 
+	V(ts->ts_done);
+}
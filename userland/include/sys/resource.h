@@ -0,0 +1,19 @@
+#ifndef _SYS_RESOURCE_H_
+#define _SYS_RESOURCE_H_
+
+/*
+ * Resource usage and limits.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+
+int getrusage(int who, struct rusage *usage);
+int getrlimit(int resource, struct rlimit *rlp);
+int setrlimit(int resource, const struct rlimit *rlp);
+int getpriority(int which, pid_t who);
+int setpriority(int which, pid_t who, int prio);
+
+#endif /* _SYS_RESOURCE_H_ */
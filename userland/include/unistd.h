@@ -40,8 +40,10 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/mman.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
+#include <kern/shm.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
@@ -147,6 +149,7 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
@@ -164,10 +167,23 @@ time_t time(time_t *seconds);			/* calls __time */
  * You should implement this version as this is what we expect to test.
  */
 
-#define PROT_READ 1
-#define PROT_WRITE 2
+/* PROT_*, MAP_PRIVATE and MADV_* are in <kern/mman.h> */
 
 void *mmap(size_t length, int prot, int fd, off_t offset);
 int munmap(void *addr);
+int mprotect(void *addr, size_t len, int prot);
+int madvise(void *addr, size_t len, int advice);
+
+/* UNSW System V style shared memory; IPC_* are in <kern/shm.h> */
+
+int shmget(int key, size_t size, int flags);
+void *shmat(int shmid, int prot);
+int shmdt(void *addr);
+int shmctl(int shmid, int cmd);
+
+/* UNSW CPU affinity; bit N of the mask is CPU N */
+
+int sched_setaffinity(pid_t pid, unsigned mask);
+int sched_getaffinity(pid_t pid, unsigned *mask);
 
 #endif /* _UNISTD_H_ */
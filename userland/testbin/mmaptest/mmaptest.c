@@ -0,0 +1,119 @@
+/*
+ * mmaptest.c
+ *
+ * Exercises shared file mappings across fork. Each round maps a file,
+ * forks, and has parent and child both write every page: the parent
+ * the first byte, the child the second. The child then exits, writing
+ * its side back, while the parent fsyncs, so both write back the same
+ * frames at once. Afterwards each side's writes must be visible both
+ * through the mapping and in the file.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define PAGE_SIZE 4096
+#define NPAGES 16
+#define ROUNDS 8
+#define FILENAME "mmaptest.tmp"
+
+static char buf[PAGE_SIZE];
+
+static
+void
+check(int fd, char *map, int round)
+{
+	unsigned i;
+	char p = 'a' + round, c = 'A' + round;
+
+	for (i = 0; i < NPAGES; i++) {
+		if (map[i * PAGE_SIZE] != p || map[i * PAGE_SIZE + 1] != c) {
+			errx(1, "round %d: page %u wrong in the mapping",
+			     round, i);
+		}
+	}
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	for (i = 0; i < NPAGES; i++) {
+		if (read(fd, buf, PAGE_SIZE) != PAGE_SIZE) {
+			err(1, "read");
+		}
+		if (buf[0] != p || buf[1] != c) {
+			errx(1, "round %d: page %u wrong in the file",
+			     round, i);
+		}
+	}
+}
+
+int
+main(void)
+{
+	int fd, round, status;
+	unsigned i;
+	char *map;
+	pid_t pid;
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	memset(buf, 0, sizeof(buf));
+	for (i = 0; i < NPAGES; i++) {
+		if (write(fd, buf, PAGE_SIZE) != PAGE_SIZE) {
+			err(1, "write");
+		}
+	}
+
+	for (round = 0; round < ROUNDS; round++) {
+		map = mmap(NPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE, fd, 0);
+		if (map == (void *)-1) {
+			err(1, "mmap");
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			for (i = 0; i < NPAGES; i++) {
+				map[i * PAGE_SIZE + 1] = 'A' + round;
+			}
+			/* written back on the way out */
+			_exit(0);
+		}
+
+		for (i = 0; i < NPAGES; i++) {
+			map[i * PAGE_SIZE] = 'a' + round;
+		}
+		if (fsync(fd) < 0) {
+			err(1, "fsync");
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "round %d: child failed", round);
+		}
+
+		/* the child's writes may have landed after our fsync */
+		if (fsync(fd) < 0) {
+			err(1, "fsync");
+		}
+		check(fd, map, round);
+		if (munmap(map) < 0) {
+			err(1, "munmap");
+		}
+	}
+
+	close(fd);
+	remove(FILENAME);
+	printf("mmaptest: passed\n");
+	return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * nicetest.c
+ *
+ * Runs two CPU hogs side by side, one at nice 0 and one at the nice
+ * value given on the command line (default 5), and reports how the
+ * CPU was shared between them. Each nice step should be worth about
+ * 1.25x, so the ratio printed should come out near 1.25^nice.
+ *
+ * The hogs count loop iterations into a shared memory segment. Run
+ * this on a single CPU, or the hogs just get one each.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define SECONDS 10
+
+static volatile unsigned *counts;
+
+static
+void
+hog(unsigned which, int nice)
+{
+	time_t start;
+	unsigned n;
+
+	if (setpriority(PRIO_PROCESS, 0, nice) < 0) {
+		err(1, "setpriority");
+	}
+	if (getpriority(PRIO_PROCESS, 0) != nice) {
+		errx(1, "getpriority: nice %d did not stick", nice);
+	}
+
+	start = time(NULL);
+	for (n = 0; ; n++) {
+		if (n % 1024 == 0) {
+			counts[which] = n;
+			if (time(NULL) - start >= SECONDS) {
+				break;
+			}
+		}
+	}
+	exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nice = 5;
+	int shmid, status;
+	unsigned i;
+	pid_t pids[2];
+	unsigned expect, ratio;		/* in hundredths */
+
+	if (argc > 1) {
+		nice = atoi(argv[1]);
+	}
+	if (nice < 0 || nice >= PRIO_MAX) {
+		errx(1, "usage: nicetest [0-%d]", PRIO_MAX - 1);
+	}
+
+	shmid = shmget(IPC_PRIVATE, 2 * sizeof(unsigned), IPC_CREAT);
+	if (shmid < 0) {
+		err(1, "shmget");
+	}
+	counts = shmat(shmid, PROT_READ | PROT_WRITE);
+	if (counts == (void *)-1) {
+		err(1, "shmat");
+	}
+	counts[0] = counts[1] = 0;
+
+	printf("nicetest: nice 0 against nice %d for %d seconds\n",
+	       nice, SECONDS);
+	for (i = 0; i < 2; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			hog(i, i == 0 ? 0 : nice);
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "hog %u failed", i);
+		}
+	}
+
+	/* no floating point in printf */
+	expect = 100;
+	for (i = 0; i < (unsigned)nice; i++) {
+		expect = expect * 5 / 4;
+	}
+	ratio = counts[1] > 0 ? counts[0] * 100ULL / counts[1] : 0;
+	printf("nice 0: %u, nice %d: %u\n", counts[0], nice, counts[1]);
+	printf("share ratio %u.%02u, expected about %u.%02u\n",
+	       ratio / 100, ratio % 100, expect / 100, expect % 100);
+
+	shmdt((void *)counts);
+	shmctl(shmid, IPC_RMID);
+	return 0;
+}